@@ -21,6 +21,9 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "uio.h"
+#include "fcntl.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,6 +53,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  struct pollq pq; // poll() calls waiting for input
 } cons;
 
 //
@@ -58,11 +62,12 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
+  int i, c;
+  struct uio u;
 
+  uioinit(&u, user_src, src, n, 0);
   for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+    if((c = uiogetc(&u)) == -1)
       break;
     uartputc(c);
   }
@@ -81,9 +86,10 @@ consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
   int c;
-  char cbuf;
+  struct uio u;
 
   target = n;
+  uioinit(&u, user_dst, dst, n, 1);
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
@@ -108,11 +114,9 @@ consoleread(int user_dst, uint64 dst, int n)
     }
 
     // copy the input byte to the user-space buffer.
-    cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    if(uioputc(&u, c) == -1)
       break;
 
-    dst++;
     --n;
 
     if(c == '\n'){
@@ -126,6 +130,36 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() on the console: input is ready when consoleread()
+// has a line to return, and output when the uart has room.
+//
+int
+consolepoll(int events, struct pollent *pe)
+{
+  int revents = 0;
+
+  if(events & POLLIN){
+    acquire(&cons.lock);
+    if(pe)
+      pe->ready = 0;
+    if(cons.r != cons.w)
+      revents |= POLLIN;
+    else
+      pollqadd(&cons.pq, &cons.lock, pe);
+    release(&cons.lock);
+  }
+  // a pollent waits on one queue; if both are wanted, the
+  // wait for output space uses the second.
+  if(events & POLLOUT){
+    if((events & POLLIN) && pe)
+      pe = pe->also;
+    if(uartwritable(revents ? 0 : pe))
+      revents |= POLLOUT;
+  }
+  return revents;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -170,6 +204,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup(&cons.pq);
       }
     }
     break;
@@ -189,4 +224,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
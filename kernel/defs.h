@@ -1,13 +1,22 @@
 struct buf;
 struct context;
+struct cpage;
+struct fdtable;
 struct file;
 struct inode;
+struct iovec;
+struct mm;
 struct pipe;
+struct pollent;
+struct pollq;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct uio;
+struct vdso;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -24,6 +33,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             elfload(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -33,6 +43,26 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filepoll(struct file*, int, struct pollent*);
+void            pollqadd(struct pollq*, struct spinlock*, struct pollent*);
+void            polldel(struct pollent*);
+void            pollwakeup(struct pollq*);
+int             filesplice(struct file*, struct file*, int);
+int             filetee(struct file*, struct file*, int);
+int             fdtalloc(struct proc*, struct fdtable*);
+void            fdtshare(struct proc*, struct fdtable*);
+void            fdtput(struct proc*);
+struct file*    fdget(int);
+void            fdrelease(void);
+struct file*    fddup(int);
+struct inode*   fdtcwd(void);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
 
 // fs.c
 void            fsinit(int);
@@ -53,6 +83,7 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+struct cpage*   ipage(struct inode*, uint);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,30 +94,66 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kdup(void *);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            logflush(void);
+int             logmode(int);
+
+// pagecache.c
+void            pcacheinit(void);
+struct cpage*   pcacheget(uint, uint, uint);
+struct cpage*   pcachepeek(uint, uint, uint);
+void            pcacherelse(struct cpage*);
+void            pcacheinval(uint, uint);
+int             pcachereclaim(void);
+
+// mm.c
+void            mminit(void);
+int             mmalloc(struct proc*);
+int             mmshare(struct proc*, struct mm*);
+void            mmput(struct proc*);
+void            mmsync(void);
+void            mmunmap(struct mm*, uint64, uint64);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipesplicein(struct pipe*, char*, uint, uint);
+int             pipespliceout(struct pipe*, uint, char**, uint*, int);
+int             pipepeek(struct pipe*, uint, char**, uint*, uint*);
+int             pipepoll(struct pipe*, int, int, struct pollent*);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// prof.c
+extern int      profiling;
+void            profinit(void);
+void            profstart(void);
+void            profstop(void);
+void            profsample(void);
+int             profread(uint64, int);
+
 // proc.c
+int             asidalloc(void);
+void            asidfree(int);
+int             clone(uint64, uint64, uint64);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             join(int, uint64);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -97,10 +164,16 @@ void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+void            setrunnable(struct proc*);
+int             setnice(int, int);
+void            schedboost(void);
+void            schedtick(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeone(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -120,6 +193,7 @@ void            pop_off(void);
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -145,15 +219,38 @@ extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
+extern struct vdso *vdso;
 void            usertrapret(void);
+uint64          usertrapfast(void);
+
+// timer.c
+void            timersinit(void);
+int             timersleep(uint64);
+void            timerwaitstart(void);
+int             timerwait(uint64);
+void            timerwake(struct proc*);
+void            timerexpire(void);
+void            timerarm(void);
+void            timerkick(int);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 void            uartputc_sync(int);
+int             uartwritable(struct pollent*);
 int             uartgetc(void);
 
+// vma.c
+struct vma*     vmalookup(struct proc*, uint64);
+int             vmafault(struct proc*, uint64, int, int);
+void            vmaprefault(struct proc*, uint64, uint64, int);
+uint64          vmaspace(struct proc*, uint64);
+int             vmamap(struct proc*, uint64, uint64, int, int, struct inode*, uint);
+int             vmaunmap(struct proc*, uint64, uint64);
+int             vmacopy(struct proc*, struct proc*);
+void            vmafree(pagetable_t, struct vma*);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
@@ -167,10 +264,16 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
+int             lockedcopyout(pagetable_t, uint64, char *, uint64);
+int             lockedcopyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+void            uioinit(struct uio*, int, uint64, uint64, int);
+int             uiogetc(struct uio*);
+int             uioputc(struct uio*, int);
 
 // plic.c
 void            plicinit(void);
@@ -3,14 +3,31 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "mm.h"
 #include "defs.h"
 #include "elf.h"
-
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+#include "fcntl.h"
 
 int
 exec(char *path, char **argv)
+{
+  struct proc *p = myproc();
+
+  // the other threads would lose their address space.
+  if(p->mm->ref > 1)
+    return -1;
+  return elfload(p, path, argv);
+}
+
+// Replace p's user memory with the program at path, with
+// argv on its stack, and set p's registers to start it.
+// p is the caller, from exec(), or a new process that isn't
+// running yet, from spawn().
+// Returns argc, or -1 leaving p's memory as it was.
+int
+elfload(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -18,8 +35,11 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+
+  memset(vma, 0, sizeof(vma));
+  v = vma;
 
   begin_op();
 
@@ -38,7 +58,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Describe each program segment with a vma; its pages are
+  // read in by vmafault() when the program first touches them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,21 +69,34 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    sz = sz1;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    // segments must not share pages or overlap the stack.
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz > MMAPBASE - 2*PGSIZE)
+      goto bad;
+    if(v == &vma[NVMA])
       goto bad;
+    v->addr = ph.vaddr;
+    v->len = PGROUNDUP(ph.memsz);
+    v->prot = 0;
+    if(ph.flags & ELF_PROG_FLAG_READ)
+      v->prot |= PROT_READ;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      v->prot |= PROT_WRITE;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      v->prot |= PROT_EXEC;
+    v->flags = MAP_PRIVATE;
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    v++;
+    sz = PGROUNDUP(ph.vaddr + ph.memsz);
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = p->mm->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -110,10 +144,14 @@ exec(char *path, char **argv)
     
   // Commit to the user image.
   oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+  p->pagetable = p->mm->pagetable = pagetable;
+  // the old image's translations have p's ASID too.
+  sfence_vma_asid(p->mm->asid);
+  p->mm->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  vmafree(oldpagetable, p->mm->vma);
+  memmove(p->mm->vma, vma, sizeof(vma));
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
@@ -125,33 +163,6 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vmafree(0, vma);
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
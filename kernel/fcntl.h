@@ -3,4 +3,32 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
-#define O_NOFOLLOW 0x800
\ No newline at end of file
+#define O_NOFOLLOW 0x800
+
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+#define MAP_SHARED  0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
+// one buffer for readv() and writev().
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
+
+// one file for poll().
+struct pollfd {
+  int fd;
+  short events;            // POLLIN, POLLOUT
+  short revents;           // set by poll()
+};
+
+#define POLLIN   0x001     // read won't block
+#define POLLOUT  0x004     // write won't block
+#define POLLERR  0x008     // pipe has no reader
+#define POLLHUP  0x010     // pipe has no writer
+#define POLLNVAL 0x020     // fd not open
@@ -0,0 +1,8 @@
+// A process's open files and current directory, shared by
+// the threads of a process as its struct mm is.
+struct fdtable {
+  struct spinlock lock;        // held to use ofile[], cwd or ref
+  int ref;                     // Threads using it
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
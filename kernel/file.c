@@ -12,6 +12,10 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "pagecache.h"
+#include "fcntl.h"
+#include "poll.h"
+#include "fdtable.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -82,6 +86,136 @@ fileclose(struct file *f)
   }
 }
 
+// Give p a new fd table, with copies of the references in
+// from, or if from is 0 an empty one, with no current
+// directory yet. Returns 0, or -1 if out of memory.
+int
+fdtalloc(struct proc *p, struct fdtable *from)
+{
+  struct fdtable *fdt;
+  int fd;
+
+  if((fdt = (struct fdtable*)kalloc()) == 0)
+    return -1;
+  memset(fdt, 0, sizeof(*fdt));
+  initlock(&fdt->lock, "fdtable");
+  fdt->ref = 1;
+  if(from){
+    acquire(&from->lock);
+    for(fd = 0; fd < NOFILE; fd++)
+      if(from->ofile[fd])
+        fdt->ofile[fd] = filedup(from->ofile[fd]);
+    fdt->cwd = idup(from->cwd);
+    release(&from->lock);
+  }
+  p->fdt = fdt;
+  return 0;
+}
+
+// Have the new thread np share fdt.
+void
+fdtshare(struct proc *np, struct fdtable *fdt)
+{
+  acquire(&fdt->lock);
+  fdt->ref++;
+  release(&fdt->lock);
+  np->fdt = fdt;
+}
+
+// Drop p's use of its fd table. If p was the last thread
+// using it, close the files and release the current
+// directory, which may sleep.
+void
+fdtput(struct proc *p)
+{
+  struct fdtable *fdt = p->fdt;
+  int fd, last;
+
+  if(fdt == 0)
+    return;
+  p->fdt = 0;
+  acquire(&fdt->lock);
+  last = --fdt->ref == 0;
+  release(&fdt->lock);
+  if(!last)
+    return;
+
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fdt->ofile[fd])
+      fileclose(fdt->ofile[fd]);
+  begin_op();
+  iput(fdt->cwd);
+  end_op();
+  kfree((void*)fdt);
+}
+
+// Return the file open as fd in the current process, or 0.
+// If threads share the fd table, another could close fd
+// while the caller uses the file, so take a reference, which
+// fdrelease() drops when the system call returns. A thread
+// can't gain a sibling mid-call, so an unshared table needs
+// none.
+struct file*
+fdget(int fd)
+{
+  struct proc *p = myproc();
+  struct fdtable *fdt = p->fdt;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&fdt->lock);
+  if((f = fdt->ofile[fd]) != 0 && fdt->ref > 1){
+    if(p->nfdheld == NELEM(p->fdheld))
+      panic("fdget");
+    p->fdheld[p->nfdheld++] = filedup(f);
+  }
+  release(&fdt->lock);
+  return f;
+}
+
+// Drop the references fdget() took during this system call.
+void
+fdrelease(void)
+{
+  struct proc *p = myproc();
+
+  while(p->nfdheld > 0)
+    fileclose(p->fdheld[--p->nfdheld]);
+}
+
+// Return a new reference to the file open as fd in the
+// current process, or 0; for callers that look up more files
+// than fdget() can hold, or keep one past the system call.
+struct file*
+fddup(int fd)
+{
+  struct fdtable *fdt = myproc()->fdt;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&fdt->lock);
+  if((f = fdt->ofile[fd]) != 0)
+    filedup(f);
+  release(&fdt->lock);
+  return f;
+}
+
+// Return a new reference to the current process's current
+// directory.
+struct inode*
+fdtcwd(void)
+{
+  struct fdtable *fdt = myproc()->fdt;
+  struct inode *ip;
+
+  acquire(&fdt->lock);
+  ip = idup(fdt->cwd);
+  release(&fdt->lock);
+  return ip;
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int
@@ -106,27 +240,73 @@ filestat(struct file *f, uint64 addr)
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
+// Read from file f into the niov buffers of iov in turn,
+// which are at user virtual addresses, stopping early at a
+// short read. Reads at f->off if off is -1, and otherwise at
+// off, which only an inode allows.
+// Returns the number of bytes read, or -1.
+int
+filereadv(struct file *f, struct iovec *iov, int niov, int off)
+{
+  int i, r, tot;
+  uint pos;
 
   if(f->readable == 0)
     return -1;
+  if(f->type != FD_INODE && off != -1)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+  tot = 0;
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].read))
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    for(i = 0; i < niov; i++){
+      // like read(), block only until some bytes arrive: go
+      // on to the next buffer only if more are waiting, or
+      // the pipe's writer has gone, when it reads 0 at once.
+      if(i > 0 && (filepoll(f, POLLIN, 0) & (POLLIN|POLLHUP)) == 0)
+        break;
+      if(f->type == FD_PIPE)
+        r = piperead(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len);
+      else
+        r = devsw[f->major].read(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    pos = off == -1 ? f->off : off;
+    for(i = 0; i < niov; i++){
+      r = readi(f->ip, 1, (uint64)iov[i].iov_base, pos, iov[i].iov_len);
+      if(r < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      pos += r;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    if(off == -1)
+      f->off = pos;
     iunlock(f->ip);
   } else {
     panic("fileread");
   }
 
-  return r;
+  return tot;
 }
 
 // Write to file f.
@@ -134,17 +314,50 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+// Write the niov buffers of iov, at user virtual addresses,
+// to file f in turn, at f->off if off is -1 and otherwise at
+// off, which only an inode allows. An inode is written in as
+// few log transactions as their size limit allows, however
+// the bytes are split among the buffers.
+// Returns the number of bytes written, or -1.
+int
+filewritev(struct file *f, struct iovec *iov, int niov, int off)
+{
+  int i, r, n, n1 = 0, m, tot;
+  uint pos, done;
 
   if(f->writable == 0)
     return -1;
+  if(f->type != FD_INODE && off != -1)
+    return -1;
+
+  n = 0;
+  for(i = 0; i < niov; i++)
+    n += iov[i].iov_len;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+  tot = 0;
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].write))
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    for(i = 0; i < niov; i++){
+      if(f->type == FD_PIPE)
+        r = pipewrite(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len);
+      else
+        r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
@@ -153,16 +366,31 @@ filewrite(struct file *f, uint64 addr, int n)
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
+    pos = off;
+    i = 0;
+    done = 0;  // bytes of iov[i] written
+    r = 0;
+    while(tot < n){
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      if(off == -1)
+        pos = f->off;
+      // the bytes written in one transaction are contiguous
+      // in the file, however many buffers they come from.
+      for(m = 0; m < max && tot < n; i++, done = 0){
+        n1 = iov[i].iov_len - done;
+        if(n1 > max - m)
+          n1 = max - m;
+        if((r = writei(f->ip, 1, (uint64)iov[i].iov_base + done, pos, n1)) != n1)
+          break;
+        pos += r;
+        m += r;
+        tot += r;
+        if((done += r) < iov[i].iov_len)
+          break;
+      }
+      if(off == -1)
+        f->off = pos;
       iunlock(f->ip);
       end_op();
 
@@ -170,13 +398,224 @@ filewrite(struct file *f, uint64 addr, int n)
         // error from writei
         break;
       }
-      i += r;
     }
-    ret = (i == n ? n : -1);
+    tot = (tot == n ? n : -1);
   } else {
     panic("filewrite");
   }
 
-  return ret;
+  return tot;
 }
 
+// Put pe on q, which lk protects, if it isn't on a queue.
+// Caller must hold lk.
+void
+pollqadd(struct pollq *q, struct spinlock *lk, struct pollent *pe)
+{
+  if(pe == 0 || pe->q != 0)
+    return;
+  pe->q = q;
+  pe->lk = lk;
+  pe->next = q->head;
+  q->head = pe;
+}
+
+// Take pe off its queue, if it is on one.
+void
+polldel(struct pollent *pe)
+{
+  struct pollent **pp;
+
+  if(pe->q == 0)
+    return;
+  acquire(pe->lk);
+  for(pp = &pe->q->head; *pp; pp = &(*pp)->next){
+    if(*pp == pe){
+      *pp = pe->next;
+      break;
+    }
+  }
+  release(pe->lk);
+  pe->q = 0;
+}
+
+// Tell the poll() calls waiting on q to look again.
+// Caller must hold the lock that protects q.
+void
+pollwakeup(struct pollq *q)
+{
+  struct pollent *pe;
+
+  for(pe = q->head; pe; pe = pe->next){
+    pe->ready = 1;
+    timerwake(pe->proc);
+  }
+}
+
+// Return which of the POLLIN and POLLOUT in events f is ready
+// for, plus POLLHUP or POLLERR, for poll(). If none, and pe
+// isn't 0, put pe on the queue of whatever f waits on, to be
+// woken when that changes. A file of an inode is always ready.
+int
+filepoll(struct file *f, int events, struct pollent *pe)
+{
+  if(!f->readable)
+    events &= ~POLLIN;
+  if(!f->writable)
+    events &= ~POLLOUT;
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, events, pe);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+     devsw[f->major].poll)
+    return devsw[f->major].poll(events, pe);
+  return events & (POLLIN|POLLOUT);
+}
+
+// Move up to n bytes from the file at f->off to pipe pi,
+// handing over page-cache pages rather than copying them.
+static int
+splicefromfile(struct file *f, struct pipe *pi, int n)
+{
+  struct cpage *pg;
+  char *page;
+  uint off, m;
+  int tot;
+
+  for(tot = 0; tot < n; tot += m){
+    ilock(f->ip);
+    off = f->off;
+    if(off >= f->ip->size){
+      iunlock(f->ip);
+      break;
+    }
+    if((pg = ipage(f->ip, off / PGSIZE)) == 0){
+      iunlock(f->ip);
+      return tot > 0 ? tot : -1;
+    }
+    m = PGSIZE - off % PGSIZE;
+    if(m > n - tot)
+      m = n - tot;
+    if(m > f->ip->size - off)
+      m = f->ip->size - off;
+    // the pipe's own reference keeps the page's memory even
+    // if the cache lets it go.
+    page = pg->data;
+    kdup(page);
+    pcacherelse(pg);
+    iunlock(f->ip);
+
+    // don't hold the inode lock while waiting for the pipe
+    // to have room.
+    if(pipesplicein(pi, page, off % PGSIZE, m) < 0){
+      kfree(page);
+      return tot > 0 ? tot : -1;
+    }
+    ilock(f->ip);
+    f->off += m;
+    iunlock(f->ip);
+  }
+  return tot;
+}
+
+// Move up to n bytes from pipe pi to the file at f->off.
+// Waits for data only if there is none to begin with.
+static int
+splicetofile(struct pipe *pi, struct file *f, int n)
+{
+  // as in filewrite(), to keep within a log transaction.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  char *page;
+  uint off;
+  int tot, i, n1, r = 0, w;
+
+  for(tot = 0; tot < n; tot += r){
+    if((r = pipespliceout(pi, n - tot, &page, &off, tot == 0)) <= 0)
+      break;
+    for(i = 0; i < r; i += w){
+      n1 = r - i;
+      if(n1 > max)
+        n1 = max;
+      begin_op();
+      ilock(f->ip);
+      if((w = writei(f->ip, 0, (uint64)page + off + i, f->off, n1)) > 0)
+        f->off += w;
+      iunlock(f->ip);
+      end_op();
+      if(w != n1)
+        break;
+    }
+    kfree(page);
+    if(i != r)
+      return -1;
+  }
+  return tot > 0 ? tot : r;
+}
+
+// Move up to n bytes from pipe pi0 to pipe pi1.
+// Waits for data only if there is none to begin with.
+static int
+splicepipes(struct pipe *pi0, struct pipe *pi1, int n)
+{
+  char *page;
+  uint off;
+  int tot, r = 0;
+
+  for(tot = 0; tot < n; tot += r){
+    if((r = pipespliceout(pi0, n - tot, &page, &off, tot == 0)) <= 0)
+      break;
+    if(pipesplicein(pi1, page, off, r) < 0){
+      // the bytes are lost, as they would be if a process
+      // had read them and then failed to write them.
+      kfree(page);
+      return -1;
+    }
+  }
+  return tot > 0 ? tot : r;
+}
+
+// Move up to n bytes from fin to fout without copying them
+// through user space: from a file to a pipe, a pipe to a
+// file, or a pipe to another pipe.
+// Returns the number of bytes moved, 0 at end of file, or -1.
+int
+filesplice(struct file *fin, struct file *fout, int n)
+{
+  if(fin->readable == 0 || fout->writable == 0 || n < 0)
+    return -1;
+  if(fin->type == FD_INODE && fout->type == FD_PIPE)
+    return splicefromfile(fin, fout->pipe, n);
+  if(fin->type == FD_PIPE && fout->type == FD_INODE)
+    return splicetofile(fin->pipe, fout, n);
+  if(fin->type == FD_PIPE && fout->type == FD_PIPE && fin->pipe != fout->pipe)
+    return splicepipes(fin->pipe, fout->pipe, n);
+  return -1;
+}
+
+// Copy up to n bytes from pipe fin to pipe fout, leaving
+// them in fin to be read as well. fout gets references to
+// fin's pages rather than copies.
+// Returns the number of bytes copied, 0 at end of file, or -1.
+int
+filetee(struct file *fin, struct file *fout, int n)
+{
+  char *page[PIPEPAGES];
+  uint off[PIPEPAGES], len[PIPEPAGES];
+  int i, nb, tot = 0;
+
+  if(fin->readable == 0 || fout->writable == 0 || n < 0)
+    return -1;
+  if(fin->type != FD_PIPE || fout->type != FD_PIPE || fin->pipe == fout->pipe)
+    return -1;
+  if((nb = pipepeek(fin->pipe, n, page, off, len)) < 0)
+    return -1;
+  for(i = 0; i < nb; i++){
+    if(pipesplicein(fout->pipe, page[i], off[i], len[i]) < 0)
+      break;
+    tot += len[i];
+  }
+  for(; i < nb; i++)
+    kfree(page[i]);
+  if(tot == 0 && nb > 0)
+    return -1;
+  return tot;
+}
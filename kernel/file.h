@@ -31,10 +31,13 @@ struct inode {
   uint addrs[NDIRECT+2];
 };
 
+struct pollent;
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(int, struct pollent*);  // see filepoll()
 };
 
 extern struct devsw devsw[];
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "pagecache.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -449,6 +450,8 @@ itrunc(struct inode *ip)
   struct buf *bp, *tmp;
   uint *a, *b;
 
+  pcacheinval(ip->dev, ip->inum);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -491,6 +494,35 @@ itrunc(struct inode *ip)
   iupdate(ip);
 }
 
+// Return a referenced page-cache page holding page pgno of
+// ip's content, reading it from disk if necessary. The part
+// of the page past the end of the file reads as zeros.
+// Returns 0 if there is no memory for the page.
+// Caller must hold ip->lock.
+struct cpage*
+ipage(struct inode *ip, uint pgno)
+{
+  struct cpage *pg;
+  struct buf *bp;
+  uint off;
+
+  if((pg = pcacheget(ip->dev, ip->inum, pgno)) == 0)
+    return 0;
+  if(!pg->valid){
+    for(off = 0; off < PGSIZE; off += BSIZE){
+      if(pgno*PGSIZE + off < ip->size){
+        bp = bread(ip->dev, bmap(ip, (pgno*PGSIZE + off)/BSIZE));
+        memmove(pg->data + off, bp->data, BSIZE);
+        brelse(bp);
+      } else {
+        memset(pg->data + off, 0, BSIZE);
+      }
+    }
+    pg->valid = 1;
+  }
+  return pg;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -503,7 +535,8 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
-// Read data from inode.
+// Read data from inode, a page at a time through the page
+// cache, or a block at a time if the cache has no room.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
@@ -512,6 +545,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct cpage *pg;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -519,14 +554,20 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if((pg = ipage(ip, off/PGSIZE)) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, pg->data + (off % PGSIZE), m);
+      pcacherelse(pg);
+    } else {
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
+      m = min(n - tot, BSIZE - off%BSIZE);
+      r = either_copyout(user_dst, dst, bp->data + (off % BSIZE), m);
       brelse(bp);
+    }
+    if(r == -1) {
       tot = -1;
       break;
     }
-    brelse(bp);
   }
   return tot;
 }
@@ -543,6 +584,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct cpage *pg;
 
   if(off > ip->size || off + n < off)
     return -1;
@@ -557,6 +599,12 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
+    // keep the page cache's copy, if any, up to date.
+    if((pg = pcachepeek(ip->dev, ip->inum, off/PGSIZE)) != 0){
+      if(pg->valid)
+        memmove(pg->data + (off % PGSIZE), bp->data + (off % BSIZE), m);
+      pcacherelse(pg);
+    }
     brelse(bp);
   }
 
@@ -688,7 +736,7 @@ namex(char *path, int nameiparent, char *name)
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
-    ip = idup(myproc()->cwd);
+    ip = fdtcwd();
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
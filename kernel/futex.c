@@ -0,0 +1,94 @@
+//
+// Futexes: sleeping on a word of user memory.
+//
+// futex_wait(addr, val) sleeps if the int at addr still holds
+// val, and futex_wake(addr, n) wakes up to n of the processes
+// waiting on addr, so that user-level locks need enter the
+// kernel only when contended (see mutex_lock() in ulib.c).
+// A futex is named by the physical address of the word, which
+// is also the sleep channel, so threads and processes that
+// map the same page at different addresses, with MAP_SHARED,
+// find each other.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+// the value check in futexwait() and the wakeup in futexwake()
+// must not interleave, or a wakeup could be lost.
+struct spinlock futexlocks[NFUTEXLOCK];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXLOCK; i++)
+    initlock(&futexlocks[i], "futex");
+}
+
+static struct spinlock*
+futexlock(uint64 pa)
+{
+  return &futexlocks[(pa / sizeof(int)) % NFUTEXLOCK];
+}
+
+// Return the physical address of the futex at user address
+// addr, faulting its page in if need be, or 0.
+static uint64
+futexaddr(uint64 addr)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0)
+    return 0;
+  vmaprefault(p, addr, sizeof(int), 0);
+  if((pa = walkaddr(p->pagetable, addr)) == 0)
+    return 0;
+  return pa + addr % PGSIZE;
+}
+
+// Sleep on the futex at addr if it holds val.
+// Returns 0 when woken, or -1 if it didn't hold val, the
+// address is bad, or the process was killed.
+int
+futexwait(uint64 addr, int val)
+{
+  struct spinlock *lk;
+  uint64 pa;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  lk = futexlock(pa);
+  acquire(lk);
+  if(*(int*)pa != val){
+    release(lk);
+    return -1;
+  }
+  sleep((void*)pa, lk);
+  release(lk);
+  return myproc()->killed ? -1 : 0;
+}
+
+// Wake up at most n processes waiting on the futex at addr.
+// Returns the number woken, or -1 if the address is bad.
+int
+futexwake(uint64 addr, int n)
+{
+  struct spinlock *lk;
+  uint64 pa;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  lk = futexlock(pa);
+  acquire(lk);
+  n = wakeupn((void*)pa, n);
+  release(lk);
+  return n;
+}
@@ -0,0 +1,39 @@
+// A ring of I/O requests in user memory, which io_enter()
+// carries out many to a system call. The process fills in
+// sq[sqtail % IORING_SIZE] and bumps sqtail; io_enter() takes
+// requests from sqhead, does each in turn, and posts its
+// result at cq[cqtail % IORING_SIZE]. The process can reap
+// completions from cqhead without a system call.
+
+#define IORING_SIZE 32  // entries in each ring
+
+#define IO_NOP    0
+#define IO_READ   1     // read(fd, addr, len), or pread() at off
+#define IO_WRITE  2     // write(fd, addr, len), or pwrite() at off
+#define IO_OPEN   3     // open(addr, len)
+#define IO_CLOSE  4     // close(fd)
+#define IO_FSYNC  5     // fsync(fd)
+
+struct io_sqe {
+  int op;
+  int fd;
+  uint64 addr;   // buffer, or path for IO_OPEN
+  int len;       // bytes, or mode for IO_OPEN
+  int off;       // file offset, or -1 to use and move the fd's
+  uint64 data;   // handed back in the completion
+};
+
+struct io_cqe {
+  uint64 data;   // from the request
+  int res;       // what the system call would have returned
+  int pad;
+};
+
+struct io_ring {
+  uint sqhead;   // next request; moved by io_enter()
+  uint sqtail;   // moved by the process
+  uint cqhead;   // next completion; moved by the process
+  uint cqtail;   // moved by io_enter()
+  struct io_sqe sq[IORING_SIZE];
+  struct io_cqe cq[IORING_SIZE];
+};
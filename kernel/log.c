@@ -29,6 +29,18 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// By default the last outstanding end_op() commits, so a
+// system call's writes are on disk when it returns. After
+// logmode(1), end_op() leaves the transaction open to collect
+// later system calls' writes, and commits only when begin_op()
+// would not admit another call, when fsync() asks, or when
+// logmode(0) switches back. So between calls an open
+// transaction holds at most LOGSIZE-MAXOPBLOCKS blocks, pinned
+// in the buffer cache, and begin_op() still bounds it to
+// LOGSIZE overall, as without batching. A crash loses the
+// writes since the last commit, but never leaves the file
+// system inconsistent.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,6 +55,9 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int batch;       // don't commit at every end_op(); see logmode().
+  int force;       // logflush() wants the next end_op() to commit.
+  uint ncommit;    // commits so far.
   int dev;
   struct logheader lh;
 };
@@ -50,6 +65,7 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void commitlog(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -130,6 +146,10 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
+    } else if(log.force){
+      // logflush() is waiting for the outstanding calls to
+      // finish; don't let new ones keep it waiting.
+      sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
@@ -142,19 +162,20 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless the log is in batch mode and has room.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  // in batch mode, commit once begin_op() would not admit
+  // another call, or it would wait for a commit forever.
+  if(log.outstanding == 0 &&
+     (!log.batch || log.force || log.lh.n + MAXOPBLOCKS > LOGSIZE)){
+    commitlog();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,16 +183,67 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Commit the open transaction, with no operations outstanding.
+// Caller must hold log.lock, which commitlog() releases while
+// it writes to the disk, since it is not allowed to sleep
+// with locks.
+static void
+commitlog(void)
+{
+  log.committing = 1;
+  log.force = 0;
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  wakeup(&log);
+}
+
+// Wait until the writes of every FS system call that has
+// finished are on disk, committing the open transaction if
+// it holds any; for fsync().
+void
+logflush(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  n = log.ncommit;
+  if(log.committing){
+    // the commit under way holds every finished call's writes.
+    while(log.ncommit == n)
+      sleep(&log, &log.lock);
+  } else if(log.lh.n > 0){
+    if(log.outstanding == 0){
+      commitlog();
+    } else {
+      // the last of them will commit.
+      log.force = 1;
+      while(log.ncommit == n)
+        sleep(&log, &log.lock);
+    }
   }
+  release(&log.lock);
+}
+
+// Turn batch mode on or off, committing any open transaction
+// when turning it off.
+// Returns the previous mode.
+int
+logmode(int batch)
+{
+  int old;
+
+  acquire(&log.lock);
+  old = log.batch;
+  log.batch = batch != 0;
+  release(&log.lock);
+  if(old && !batch)
+    logflush();
+  return old;
 }
 
 // Copy modified blocks from cache to log.
@@ -20,11 +20,16 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    mminit();        // address spaces
+    futexinit();     // futex locks
+    profinit();      // sampling profiler
     trapinit();      // trap vectors
+    timersinit();    // sleep timers
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    pcacheinit();    // page cache
     iinit();         // inode cache
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
@@ -29,6 +29,8 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_FREQ 10000000L // cycles per second in qemu.
+#define NSPERCYCLE (1000000000L / CLINT_FREQ)
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -51,8 +53,8 @@
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
-// map kernel stacks beneath the trampoline,
-// each surrounded by invalid guard pages.
+// map kernel stacks beneath the trampoline, at slots given
+// out by allocproc(), each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
 // User memory layout.
@@ -62,6 +64,15 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   MMAPBASE (mmap() regions, placed upward from here)
+//   ...
+//   VDSOPROC (struct vdsoproc, read-only)
+//   VDSO (struct vdso, read-only, shared by all)
+//   THREADFRAME(NTHREAD-1..1) (the trapframes of clone()d threads)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
+#define MMAPBASE (MAXVA / 2)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(i) (TRAPFRAME - (i)*PGSIZE)
+#define VDSO (THREADFRAME(NTHREAD-1) - PGSIZE)
+#define VDSOPROC (VDSO - PGSIZE)
@@ -0,0 +1,212 @@
+//
+// Address spaces.
+//
+// Each process has a struct mm holding its page table and
+// the regions mapped in it. A thread made by clone() shares
+// its creator's mm, with its own trapframe mapped at a free
+// THREADFRAME slot below TRAPFRAME, and so can run at the same
+// time as its siblings on other harts. A hart that unmaps
+// memory from a shared mm must then make the other harts
+// flush their TLBs before the pages are freed; see mmunmap().
+// A struct mm has a page to itself, allocated by mmalloc()
+// and freed by the last mmput().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "mm.h"
+#include "vdso.h"
+#include "defs.h"
+
+struct spinlock mm_lock;
+
+void
+mminit(void)
+{
+  if(sizeof(struct mm) > PGSIZE)
+    panic("mminit: struct mm too big");
+  initlock(&mm_lock, "mm_lock");
+}
+
+// Give p a new, empty address space, holding just the
+// trampoline, p's trapframe at TRAPFRAME, and the vdso pages.
+// Returns 0, or -1 if out of memory.
+int
+mmalloc(struct proc *p)
+{
+  struct mm *mm;
+  pagetable_t pagetable;
+
+  if((mm = (struct mm*)kalloc()) == 0)
+    return -1;
+  memset(mm, 0, sizeof(*mm));
+  initsleeplock(&mm->lock, "mm");
+  mm->ref = 1;
+  mm->frames = 1;
+  if((mm->vdsoproc = (struct vdsoproc*)kalloc()) == 0){
+    kfree((void*)mm);
+    return -1;
+  }
+  memset(mm->vdsoproc, 0, PGSIZE);
+  mm->vdsoproc->pid = p->pid;
+
+  p->tfva = TRAPFRAME;
+  p->mm = mm;  // for proc_pagetable()
+  if((pagetable = proc_pagetable(p)) == 0){
+    p->mm = 0;
+    kfree((void*)mm->vdsoproc);
+    kfree((void*)mm);
+    return -1;
+  }
+  mm->pagetable = pagetable;
+  mm->asid = asidalloc();
+  p->pagetable = pagetable;
+  p->flushgen = mm->flushgen;
+  return 0;
+}
+
+// Share mm with the new thread np, mapping np's trapframe
+// in a free THREADFRAME slot.
+// Caller must hold mm->lock.
+// Returns 0, or -1 if mm has NTHREAD threads already.
+int
+mmshare(struct proc *np, struct mm *mm)
+{
+  int i;
+
+  acquire(&mm_lock);
+  for(i = 1; i < NTHREAD; i++)
+    if((mm->frames & (1 << i)) == 0)
+      break;
+  if(i == NTHREAD){
+    release(&mm_lock);
+    return -1;
+  }
+  mm->frames |= 1 << i;
+  mm->ref++;
+  release(&mm_lock);
+
+  np->mm = mm;
+  np->pagetable = mm->pagetable;
+  np->tfva = THREADFRAME(i);
+  np->flushgen = mm->flushgen;
+  if(mappages(mm->pagetable, np->tfva, PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    mmput(np);
+    return -1;
+  }
+  return 0;
+}
+
+// Drop p's use of its address space, unmapping p's
+// trapframe. If p was the last thread using it, free the
+// memory, which writes back MAP_SHARED regions; so unless
+// p never mapped any, the caller must not hold a spin-lock.
+void
+mmput(struct proc *p)
+{
+  struct mm *mm = p->mm;
+  int last;
+
+  if(mm == 0)
+    return;
+  p->mm = 0;
+  p->pagetable = 0;
+
+  acquire(&mm_lock);
+  mm->frames &= ~(1 << ((TRAPFRAME - p->tfva) / PGSIZE));
+  last = mm->ref == 1;
+  if(!last)
+    mm->ref--;
+  release(&mm_lock);
+
+  uvmunmap(mm->pagetable, p->tfva, 1, 0);
+  if(!last)
+    return;
+
+  vmafree(mm->pagetable, mm->vma);
+  proc_freepagetable(mm->pagetable, mm->sz);
+  asidfree(mm->asid);
+  kfree((void*)mm->vdsoproc);
+  kfree((void*)mm);
+}
+
+// Make every other hart that is running a thread of mm
+// flush its TLB, and wait until they all have.
+// Threads of mm that aren't running catch up in scheduler().
+// Caller must not hold a spin-lock, or the other harts may
+// never take the interrupt.
+static void
+mmshootdown(struct mm *mm)
+{
+  struct cpu *c;
+  struct proc *p;
+  uint gen;
+
+  gen = __sync_add_and_fetch(&mm->flushgen, 1);
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    for(;;){
+      __sync_synchronize();
+      // p may be exiting on c, and be freed as we look;
+      // the page stays mapped, and the next time round
+      // sees whatever c runs next.
+      p = c->proc;
+      if(p == 0 || p == myproc() || p->mm != mm || p->flushgen == gen)
+        break;
+      // re-kick each time round; a kick can be lost to a
+      // timerarm() that was already under way.
+      timerkick(c - cpus);
+    }
+  }
+}
+
+// Called on a kick from mmshootdown(): flush the TLB if the
+// current thread's address space has lost mappings.
+void
+mmsync(void)
+{
+  struct proc *p = myproc();
+  struct mm *mm;
+
+  if(p == 0 || (mm = p->mm) == 0 || p->flushgen == mm->flushgen)
+    return;
+  p->flushgen = mm->flushgen;
+  sfence_vma();
+}
+
+// Remove npages of mappings starting from va, which must be
+// page-aligned, and free the pages.
+// Caller must hold mm->lock.
+void
+mmunmap(struct mm *mm, uint64 va, uint64 npages)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if(mm->ref == 1){
+    uvmunmap(mm->pagetable, va, npages, 1);
+    return;
+  }
+
+  // other threads may be using the pages through their TLBs.
+  // invalidate the PTEs but leave the addresses in them, so
+  // the pages can be found and freed once every hart has
+  // flushed.
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    if((pte = walk(mm->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+      *pte &= ~PTE_V;
+  }
+  sfence_vma();
+  mmshootdown(mm);
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    if((pte = walk(mm->pagetable, a, 0)) != 0 && *pte){
+      kfree((void*)PTE2PA(*pte));
+      *pte = 0;
+    }
+  }
+}
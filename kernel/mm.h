@@ -0,0 +1,27 @@
+// A region of user memory that is filled in a page at a time
+// by vmafault() when first touched. exec() records one for
+// each program segment.
+struct vma {
+  uint64 addr;                 // first virtual address, page-aligned
+  uint64 len;                  // length in bytes; 0 if slot is unused
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_PRIVATE
+  struct inode *ip;            // file the region is read from
+  uint off;                    // file offset of addr
+  uint filesz;                 // bytes read from file; the rest is zero
+};
+
+// A user address space, shared by the threads of a process.
+struct mm {
+  struct sleeplock lock;       // held to change sz or vma[], or fill a page
+  pagetable_t pagetable;       // User page table
+  int asid;                    // TLB address-space ID; 0 if none
+  uint64 sz;                   // Size of memory below the regions (bytes)
+  struct vma vma[NVMA];        // Demand-paged regions
+  struct vdsoproc *vdsoproc;   // Page mapped read-only at VDSOPROC
+  uint flushgen;               // Bumped when other harts must flush
+
+  // mm_lock must be held when using these:
+  int ref;                     // Threads using it
+  uint frames;                 // Bitmask of THREADFRAME slots in use
+};
@@ -0,0 +1,245 @@
+// Page cache.
+//
+// The page cache holds whole 4096-byte pages of file content,
+// indexed by (dev, inum, page number), in physical pages that
+// can be mapped straight into user page tables. This lets
+// processes running the same program share a single copy of
+// its read-only text, and lets read() copy a whole page at a
+// time instead of one block at a time.
+//
+// Interface:
+// * To get a page of a file, call ipage() in fs.c, which uses
+//     pcacheget() here and reads the page from disk if needed.
+//     readi() copies out of these pages.
+// * writei() writes through the buffer cache to the log as
+//     before, and copies the new data into the page too if
+//     it is cached (pcachepeek), so readers see it at once.
+// * When done with the page, call pcacherelse.
+// * To map the page into a user page table, take a separate
+//     reference to its memory with kdup() while still holding
+//     the cpage. A mapped page is not recycled; if the file is
+//     truncated the cache forgets it, but the memory stays
+//     alive until the last mapping is gone.
+// * The content of a cached page is protected by the sleep-lock
+//     of the inode it belongs to.
+// * itrunc() calls pcacheinval() before the inode's blocks are
+//     freed, so a recycled inode never sees stale pages.
+// * kalloc() calls pcachereclaim() when it runs out of memory.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "pagecache.h"
+
+#define NPCHASH 61
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  struct cpage *hash[NPCHASH];
+
+  // Linked list of all pages, through prev/next.
+  // Sorted by how recently the page was used.
+  // head.next is most recent, head.prev is least.
+  struct cpage head;
+} pcache;
+
+static uint
+pchash(uint dev, uint inum, uint pgno)
+{
+  return (dev * 31 + inum * 1009 + pgno) % NPCHASH;
+}
+
+void
+pcacheinit(void)
+{
+  struct cpage *pg;
+
+  initlock(&pcache.lock, "pcache");
+
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+}
+
+// Remove pg from its hash chain and forget its identity.
+// Returns the memory it held, for the caller to kfree().
+// Caller must hold pcache.lock.
+static char*
+pcacheforget(struct cpage *pg)
+{
+  struct cpage **pp;
+  char *data;
+
+  for(pp = &pcache.hash[pchash(pg->dev, pg->inum, pg->pgno)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == pg){
+      *pp = pg->hnext;
+      break;
+    }
+  }
+  data = pg->data;
+  pg->hnext = 0;
+  pg->data = 0;
+  pg->valid = 0;
+  pg->dev = 0;
+  pg->inum = 0;
+  pg->pgno = 0;
+  return data;
+}
+
+static struct cpage*
+pcachelookup(uint dev, uint inum, uint pgno)
+{
+  struct cpage *pg;
+
+  for(pg = pcache.hash[pchash(dev, inum, pgno)]; pg; pg = pg->hnext)
+    if(pg->dev == dev && pg->inum == inum && pg->pgno == pgno)
+      return pg;
+  return 0;
+}
+
+// Look through the page cache for page pgno of inode inum on dev.
+// If not found, recycle an unused entry.
+// In either case, return a referenced page, which is not
+// necessarily valid. Returns 0 if out of memory.
+struct cpage*
+pcacheget(uint dev, uint inum, uint pgno)
+{
+  struct cpage *pg, *victim;
+  char *mem, *old;
+
+  acquire(&pcache.lock);
+  if((pg = pcachelookup(dev, inum, pgno)) != 0){
+    pg->refcnt++;
+    release(&pcache.lock);
+    return pg;
+  }
+  release(&pcache.lock);
+
+  // Not cached. kalloc() may call pcachereclaim(),
+  // so don't hold pcache.lock.
+  if((mem = kalloc()) == 0)
+    return 0;
+
+  acquire(&pcache.lock);
+  if((pg = pcachelookup(dev, inum, pgno)) != 0){
+    // someone else read it in while we were allocating.
+    pg->refcnt++;
+    release(&pcache.lock);
+    kfree(mem);
+    return pg;
+  }
+
+  // Recycle the least recently used entry that no one holds.
+  // Pages mapped by a process are pinned: a MAP_SHARED mapping
+  // and read() must keep seeing the same copy.
+  victim = 0;
+  for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev){
+    if(pg->refcnt == 0 && (pg->data == 0 || krefcnt(pg->data) == 1)){
+      victim = pg;
+      break;
+    }
+  }
+  if(victim == 0){
+    release(&pcache.lock);
+    kfree(mem);
+    return 0;
+  }
+
+  pg = victim;
+  old = pg->data ? pcacheforget(pg) : 0;
+  pg->dev = dev;
+  pg->inum = inum;
+  pg->pgno = pgno;
+  pg->valid = 0;
+  pg->refcnt = 1;
+  pg->data = mem;
+  pg->hnext = pcache.hash[pchash(dev, inum, pgno)];
+  pcache.hash[pchash(dev, inum, pgno)] = pg;
+  release(&pcache.lock);
+
+  if(old)
+    kfree(old);
+  return pg;
+}
+
+// Return a referenced page for page pgno of inode inum on
+// dev if it is cached, or 0 if it isn't. Unlike pcacheget(),
+// never allocates.
+struct cpage*
+pcachepeek(uint dev, uint inum, uint pgno)
+{
+  struct cpage *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcachelookup(dev, inum, pgno)) != 0)
+    pg->refcnt++;
+  release(&pcache.lock);
+  return pg;
+}
+
+// Release a page.
+// Move to the head of the most-recently-used list.
+void
+pcacherelse(struct cpage *pg)
+{
+  acquire(&pcache.lock);
+  if(pg->refcnt < 1)
+    panic("pcacherelse");
+  pg->refcnt--;
+  if(pg->refcnt == 0){
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+  release(&pcache.lock);
+}
+
+// Drop all cached pages of inode inum on dev, whose
+// content is about to be freed. The caller holds the
+// inode's lock, so no one else holds any of its pages.
+void
+pcacheinval(uint dev, uint inum)
+{
+  struct cpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->data && pg->dev == dev && pg->inum == inum){
+      if(pg->refcnt != 0)
+        panic("pcacheinval");
+      kfree(pcacheforget(pg));
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Give back the memory of every cached page that is
+// neither held by the kernel nor mapped by a process.
+// Returns the number of pages freed.
+int
+pcachereclaim(void)
+{
+  struct cpage *pg;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->data && pg->refcnt == 0 && krefcnt(pg->data) == 1){
+      kfree(pcacheforget(pg));
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
@@ -0,0 +1,12 @@
+struct cpage {
+  uint dev;
+  uint inum;
+  uint pgno;          // page number within the file
+  int valid;          // has data been read from disk?
+  uint refcnt;        // kernel references; user mappings use kdup()
+  struct cpage *hnext; // hash chain
+  struct cpage *prev; // LRU cache list
+  struct cpage *next;
+  char *data;         // PGSIZE bytes from kalloc(), or 0
+};
+
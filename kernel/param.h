@@ -1,8 +1,4 @@
-#ifdef LAB_FS
-#define NPROC        10  // maximum number of processes
-#else
-#define NPROC        64  // maximum number of processes (speedsup bigfile)
-#endif
+#define NPROC      4096  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
@@ -10,9 +6,23 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NSPAWNFD      3  // file descriptors spawn() sets up
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NPCACHE    1024  // size of file page cache
+#define NIOV         16  // max buffers for readv() and writev()
+#define PIPEPAGES    16  // max pages of data a pipe holds
+#define NVMA         16  // demand-paged regions per process
+#define NTHREAD       8  // max threads sharing an address space
+#define NFUTEXLOCK   16  // locks futexes are hashed over
+#define NASID       256  // max # of TLB address-space IDs to use
+#define NMLFQ         3  // scheduler priority levels
+#define MLFQSLICE(l) (1 << (l))  // time slice in ticks at level l
+#define MLFQBOOST    50  // ticks between priority boosts
+#define TICKCYCLES 1000000  // timer cycles per tick; about 1/10th second in qemu
+#define PROFCYCLES (TICKCYCLES/10)  // timer cycles between profiler samples
+#define NPROFSAMPLES 1024  // profiler samples each hart holds
 #define FSSIZE       200000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 
@@ -7,16 +7,42 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+// A pipe's data is a queue of up to PIPEPAGES page buffers,
+// each holding a run of bytes within one page. write() copies
+// onto the end of the last buffer while it has room and then
+// starts another, so a pipe takes memory only for the data in
+// it, and a writer can run up to PIPEPAGES pages ahead of its
+// reader. Reads and writes copy as many bytes at a time as lie
+// in one page.
+//
+// splice() and tee() move data in and out of a pipe a buffer
+// at a time, handing over a reference to the page rather than
+// copying it; see pipesplicein(). Such a buffer's page may be
+// shared, with the page cache or another pipe, so it is never
+// written to. A page-cache page handed over this way shows
+// later writes to the file, as it does in Unix.
+
+struct pipebuf {
+  char *page;     // from kalloc(); a reference the pipe owns
+  uint off;       // first byte in page
+  uint len;       // bytes from off
+  int shared;     // page may have other references; don't write
+};
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  struct pipebuf buf[PIPEPAGES];
+  uint head;      // buf[head % PIPEPAGES] holds the oldest bytes
+  uint nbuf;      // buffers in use
+  char *spare;    // a free page kept for the next buffer, or 0
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct pollq pq; // poll() calls waiting on either end
 };
 
 int
@@ -32,8 +58,12 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
+  pi->head = 0;
+  pi->nbuf = 0;
+  pi->spare = 0;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->pq.head = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -55,6 +85,22 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+// Drop the oldest buffer, whose bytes have all been read.
+// Caller must hold pi->lock.
+static void
+pipepop(struct pipe *pi)
+{
+  struct pipebuf *b = &pi->buf[pi->head % PIPEPAGES];
+
+  if(!b->shared && pi->spare == 0)
+    pi->spare = b->page;
+  else
+    kfree(b->page);
+  b->page = 0;
+  pi->head++;
+  pi->nbuf--;
+}
+
 void
 pipeclose(struct pipe *pi, int writable)
 {
@@ -66,17 +112,54 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwakeup(&pi->pq);
   if(pi->readopen == 0 && pi->writeopen == 0){
+    while(pi->nbuf > 0)
+      pipepop(pi);
     release(&pi->lock);
+    if(pi->spare)
+      kfree(pi->spare);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Return the buffer that write() should copy onto, starting
+// a new one if the last is full or shared, or 0 if the pipe
+// is full.
+// Caller must hold pi->lock.
+static struct pipebuf*
+pipetail(struct pipe *pi)
+{
+  struct pipebuf *b;
+  char *page;
+
+  if(pi->nbuf > 0){
+    b = &pi->buf[(pi->head + pi->nbuf - 1) % PIPEPAGES];
+    if(!b->shared && b->off + b->len < PGSIZE)
+      return b;
+  }
+  if(pi->nbuf == PIPEPAGES)
+    return 0;
+  if((page = pi->spare) != 0)
+    pi->spare = 0;
+  else if((page = kalloc()) == 0)
+    return 0;
+  b = &pi->buf[(pi->head + pi->nbuf) % PIPEPAGES];
+  b->page = page;
+  b->off = 0;
+  b->len = 0;
+  b->shared = 0;
+  pi->nbuf++;
+  return b;
+}
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
   int i = 0;
+  uint m;
+  struct pipebuf *b;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,46 +168,221 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if((b = pipetail(pi)) == 0){ //DOC: pipewrite-full
+      if(pi->nbuf == 0)
+        break;  // out of memory; no reader will make room
       wakeup(&pi->nread);
+      pollwakeup(&pi->pq);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = PGSIZE - (b->off + b->len);
+      if(m > n - i)
+        m = n - i;
+      if(lockedcopyin(pr->pagetable, b->page + b->off + b->len, addr + i, m) == -1){
+        if(b->len == 0){
+          // an empty buffer would look like end of file.
+          pi->nbuf--;
+          if(pi->spare == 0)
+            pi->spare = b->page;
+          else
+            kfree(b->page);
+          b->page = 0;
+        }
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      }
+      b->len += m;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
+  pollwakeup(&pi->pq);
   release(&pi->lock);
 
   return i;
 }
 
-int
-piperead(struct pipe *pi, uint64 addr, int n)
+// Wait until pi has data to read, or no writer.
+// Returns 0, or -1 if the caller was killed, having released
+// pi->lock.
+// Caller must hold pi->lock.
+static int
+pipewait(struct pipe *pi)
 {
-  int i;
   struct proc *pr = myproc();
-  char ch;
 
-  acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->nbuf == 0 && pi->writeopen){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  return 0;
+}
+
+int
+piperead(struct pipe *pi, uint64 addr, int n)
+{
+  int i;
+  uint m;
+  struct pipebuf *b;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  if(pipewait(pi) < 0)
+    return -1;
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
+    if(pi->nbuf == 0)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    b = &pi->buf[pi->head % PIPEPAGES];
+    m = b->len;
+    if(m > n - i)
+      m = n - i;
+    if(lockedcopyout(pr->pagetable, addr + i, b->page + b->off, m) == -1)
       break;
+    b->off += m;
+    b->len -= m;
+    pi->nread += m;
+    if(b->len == 0)
+      pipepop(pi);
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pollwakeup(&pi->pq);
+  release(&pi->lock);
+  return i;
+}
+
+// Append the len bytes at page+off to pi as a buffer of their
+// own, without copying them, waiting for room if pi is full.
+// page is a reference from kalloc() or kdup() that pi takes
+// over, unless pipesplicein() fails.
+// Returns len, or -1 if the reader has gone or the caller
+// was killed.
+int
+pipesplicein(struct pipe *pi, char *page, uint off, uint len)
+{
+  struct pipebuf *b;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->nbuf == PIPEPAGES){
+    if(pi->readopen == 0 || pr->killed)
+      break;
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->readopen == 0 || pr->killed){
+    release(&pi->lock);
+    return -1;
+  }
+  b = &pi->buf[(pi->head + pi->nbuf) % PIPEPAGES];
+  b->page = page;
+  b->off = off;
+  b->len = len;
+  b->shared = 1;
+  pi->nbuf++;
+  pi->nwrite += len;
+  wakeup(&pi->nread);
+  pollwakeup(&pi->pq);
+  release(&pi->lock);
+  return len;
+}
+
+// Take up to n bytes from the oldest buffer of pi, as a
+// reference to its page that the caller must kfree(), with
+// the bytes at *page + *off. If pi is empty, wait for data
+// if block is set, or else return 0.
+// Returns the number of bytes, 0 at end of file, or -1 if the
+// caller was killed.
+int
+pipespliceout(struct pipe *pi, uint n, char **page, uint *off, int block)
+{
+  struct pipebuf *b;
+
+  acquire(&pi->lock);
+  if(block && pipewait(pi) < 0)
+    return -1;
+  if(pi->nbuf == 0){
+    release(&pi->lock);
+    return 0;
+  }
+  b = &pi->buf[pi->head % PIPEPAGES];
+  if(n > b->len)
+    n = b->len;
+  *page = b->page;
+  *off = b->off;
+  if(n == b->len){
+    // hand over the pipe's own reference.
+    b->page = 0;
+    pi->head++;
+    pi->nbuf--;
+  } else {
+    kdup(b->page);
+    b->shared = 1;
+    b->off += n;
+    b->len -= n;
+  }
+  pi->nread += n;
+  wakeup(&pi->nwrite);
+  pollwakeup(&pi->pq);
+  release(&pi->lock);
+  return n;
+}
+
+// Take references to the buffers holding up to the first n
+// bytes of pi, without reading them, for tee(). Fills in at
+// most PIPEPAGES of page[], off[] and len[], and marks the
+// buffers shared, since their pages now are. Waits for data
+// like read().
+// Returns the number of buffers, 0 at end of file, or -1.
+int
+pipepeek(struct pipe *pi, uint n, char **page, uint *off, uint *len)
+{
+  struct pipebuf *b;
+  int i;
+
+  acquire(&pi->lock);
+  if(pipewait(pi) < 0)
+    return -1;
+  for(i = 0; i < pi->nbuf && n > 0; i++){
+    b = &pi->buf[(pi->head + i) % PIPEPAGES];
+    kdup(b->page);
+    b->shared = 1;
+    page[i] = b->page;
+    off[i] = b->off;
+    len[i] = b->len < n ? b->len : n;
+    n -= len[i];
+  }
   release(&pi->lock);
   return i;
 }
+
+// Return which of events the read end of pi, or the write
+// end if writable is set, is ready for, as filepoll() does.
+int
+pipepoll(struct pipe *pi, int writable, int events, struct pollent *pe)
+{
+  struct pipebuf *b;
+  int revents = 0;
+
+  acquire(&pi->lock);
+  if(pe)
+    pe->ready = 0;
+  if(writable){
+    if(!pi->readopen)
+      revents |= POLLERR;
+    b = &pi->buf[(pi->head + pi->nbuf - 1) % PIPEPAGES];
+    if(pi->nbuf < PIPEPAGES || (!b->shared && b->off + b->len < PGSIZE))
+      revents |= events & POLLOUT;
+  } else {
+    if(!pi->writeopen)
+      revents |= POLLHUP;
+    if(pi->nbuf > 0)
+      revents |= events & POLLIN;
+  }
+  if(revents == 0)
+    pollqadd(&pi->pq, &pi->lock, pe);
+  release(&pi->lock);
+  return revents;
+}
@@ -0,0 +1,18 @@
+// A poll() call waiting on a file. The pollent sits on the
+// pollq of the pipe or device the file refers to, which wakes
+// every pollent on it when the pipe or device may have become
+// ready, so that poll() need only look again at those files.
+// A pollent sits on at most one queue; a device with separate
+// queues for input and output puts also on the second.
+struct pollent {
+  struct proc *proc;       // the process in poll()
+  int ready;               // set by pollwakeup(); look again
+  struct pollq *q;         // queue pe is on, or 0
+  struct spinlock *lk;     // the lock that protects q
+  struct pollent *next;    // next on q
+  struct pollent *also;    // for a second queue, or 0
+};
+
+struct pollq {
+  struct pollent *head;
+};
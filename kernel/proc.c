@@ -3,52 +3,161 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "mm.h"
+#include "fdtable.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
-
 struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// struct procs and kernel stacks are allocated by allocproc()
+// as they are needed and freed by freeproc(), so a process
+// holds memory only while it exists. Every live process is
+// on the pid hash, which is how kill() finds one and how the
+// few things that must see them all walk them.
+// pid_lock protects the hash and nextpid; it is acquired
+// before any p->lock.
+#define NPIDHASH 251
+
+struct proc *pidhash[NPIDHASH];
+
+// Kernel stack slots. A process's stack is mapped at
+// KSTACK(slot) in the kernel page table, above an invalid
+// guard page, for as long as the process exists.
+struct {
+  struct spinlock lock;
+  int free[NPROC];     // slots not in use
+  int nfree;
+} kstacks;
+
+// wait_lock keeps a parent's wakeup in wait() or join() from
+// being lost, and a child from being freed while its exit()
+// is still looking at its parent. It protects p->parent,
+// p->thread and the child lists, and is acquired before
+// pid_lock and any p->lock.
+//
+// A process's children are on one of three lists: children
+// that are still running, zombies that wait() can reap at
+// once, and threads, which join() reaps. So wait(), exit()
+// and reparent() look only at the process's own children.
+struct spinlock wait_lock;
+
+// The scheduler is a multi-level feedback queue. A process
+// starts at its nice level and drops a level each time it
+// uses up the time slice for its level, MLFQSLICE(level)
+// ticks, so CPU-bound processes sink and ones that mostly
+// sleep, such as sh, stay on top. A hart always runs the
+// highest-priority process it has, and preempts a lower one
+// on the next tick. Every MLFQBOOST ticks, schedboost()
+// starts a new epoch, which lifts every process back to its
+// nice level so that none starves.
+uint schedepoch;
+
+// Wait queues. A sleeping process is linked on the queue its
+// channel hashes to, so wakeup() need only look at processes
+// that might be sleeping on the channel rather than at every
+// process. A sleeper stays on its queue until it has woken
+// up and taken itself off, so a process on a queue can't be
+// freed while the queue's lock is held. Lock order is a
+// queue's lock, then p->lock.
+#define NSLEEPQ 61
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;   // sleepers, oldest first
+} sleepq[NSLEEPQ];
+
+// TLB address-space IDs. Each process gets its own, so that
+// switching page tables needn't flush the TLB. ASID 0 is the
+// kernel's; a process that can't get one (the hardware has
+// too few) runs with 0, and trampoline.S flushes the whole
+// TLB on each switch, as if there were no ASIDs.
+struct {
+  struct spinlock lock;
+  int n;               // ASIDs 1..n-1 may be handed out
+  char used[NASID];
+} asids;
+
 extern void forkret(void);
-static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static void childlink(struct proc **head, struct proc *p);
+static void childunlink(struct proc *p);
+static void asidinit(void);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl) {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+// Allocate a kernel stack and map it at a free slot.
+// Returns its virtual address, or 0 if out of memory or
+// every slot is taken.
+static uint64
+kstackalloc(void)
+{
+  char *pa;
+  uint64 va;
+
+  if((pa = kalloc()) == 0)
+    return 0;
+  acquire(&kstacks.lock);
+  if(kstacks.nfree == 0){
+    release(&kstacks.lock);
+    kfree(pa);
+    return 0;
   }
+  va = KSTACK(kstacks.free[--kstacks.nfree]);
+  // every hart shares the kernel page table, so the lock
+  // is held while mappages() may add page-table pages to it.
+  if(mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) < 0){
+    kstacks.nfree++;
+    release(&kstacks.lock);
+    kfree(pa);
+    return 0;
+  }
+  release(&kstacks.lock);
+  return va;
+}
+
+// Unmap and free the kernel stack at va. Other harts may
+// still have the old mapping in their TLBs; scheduler()
+// flushes it before a process whose stack reuses the slot
+// runs there.
+static void
+kstackfree(uint64 va)
+{
+  acquire(&kstacks.lock);
+  uvmunmap(kernel_pagetable, va, 1, 1);
+  kstacks.free[kstacks.nfree++] = (TRAMPOLINE - va) / (2*PGSIZE) - 1;
+  release(&kstacks.lock);
 }
 
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
-  struct proc *p;
+  struct cpu *c;
+  struct sleepq *q;
+  int i;
   
+  if(sizeof(struct proc) > PGSIZE)
+    panic("procinit: struct proc too big");
   initlock(&pid_lock, "nextpid");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  initlock(&wait_lock, "wait_lock");
+  initlock(&kstacks.lock, "kstacks");
+  for(i = 0; i < NPROC; i++)
+    kstacks.free[i] = NPROC - 1 - i;
+  kstacks.nfree = NPROC;
+  asidinit();
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rqlock, "runq");
+  for(q = sleepq; q < &sleepq[NSLEEPQ]; q++)
+    initlock(&q->lock, "sleepq");
 }
 
 // Must be called with interrupts disabled,
@@ -80,53 +189,115 @@ myproc(void) {
   return p;
 }
 
-int
-allocpid() {
-  int pid;
-  
+// Give p a pid, and put it on the pid hash.
+static void
+allocpid(struct proc *p) {
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
   release(&pid_lock);
-
-  return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// Return the live process with the given pid, or 0.
+// Caller must hold pid_lock.
 static struct proc*
-allocproc(void)
+pidlookup(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Find out how many ASID bits the hardware implements,
+// by writing ones to satp's ASID field and reading it back.
+// Paging must already be on.
+static void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asids.lock, "asid");
+  w_satp(satp | SATP_ASID_MASK);
+  asids.n = ((r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT) + 1;
+  w_satp(satp);
+  sfence_vma();
+  if(asids.n > NASID)
+    asids.n = NASID;
+}
+
+// Return an unused ASID, or 0 if they've run out.
+int
+asidalloc(void)
+{
+  int i;
+
+  acquire(&asids.lock);
+  for(i = 1; i < asids.n; i++){
+    if(!asids.used[i]){
+      asids.used[i] = 1;
+      release(&asids.lock);
+      return i;
     }
   }
+  release(&asids.lock);
   return 0;
+}
+
+void
+asidfree(int asid)
+{
+  if(asid == 0)
+    return;
+  acquire(&asids.lock);
+  asids.used[asid] = 0;
+  release(&asids.lock);
+}
+
+// Allocate a proc and a kernel stack for it.
+// Initialize state required to run in the kernel,
+// give it a new address space, or a share of mm if mm != 0,
+// and return with p->lock held.
+// If there are too many processes, or a memory allocation
+// fails, return 0.
+static struct proc*
+allocproc(struct mm *mm)
+{
+  struct proc *p;
 
-found:
-  p->pid = allocpid();
+  if((p = (struct proc*)kalloc()) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
+  if((p->kstack = kstackalloc()) == 0){
+    kfree((void*)p);
+    return 0;
+  }
+
+  acquire(&p->lock);
+  allocpid(p);
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    release(&p->lock);
+    freeproc(p);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  // An empty user page table, or mm's.
+  if((mm ? mmshare(p, mm) : mmalloc(p)) < 0){
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
+  p->hart = -1;
+  p->level = 0;
+  p->nice = 0;
+  p->runticks = 0;
+  p->epoch = schedepoch;
+  p->tmidx = -1;
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -138,25 +309,35 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages and the kernel stack.
+// p->lock must be held; freeproc() releases it.
 static void
 freeproc(struct proc *p)
 {
+  struct proc **pp;
+  int pid = p->pid;
+
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
+  mmput(p);
   p->pid = 0;
-  p->parent = 0;
-  p->name[0] = 0;
-  p->chan = 0;
-  p->killed = 0;
-  p->xstate = 0;
   p->state = UNUSED;
+  release(&p->lock);
+
+  // kill() may have found p on the hash and be waiting for
+  // p->lock; it holds pid_lock until it is done with p.
+  acquire(&pid_lock);
+  for(pp = &pidhash[pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pid_lock);
+
+  kstackfree(p->kstack);
+  kfree((void*)p);
 }
 
 // Create a user page table for a given process,
@@ -181,14 +362,24 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe just below TRAMPOLINE, for trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
+  // map the trapframe just below TRAMPOLINE, for trampoline.S,
+  // or where p's thread slot puts it.
+  if(mappages(pagetable, p->tfva, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
   }
 
+  // map the vdso pages, which the process may read but
+  // not write.
+  if(mappages(pagetable, VDSO, PGSIZE, (uint64)vdso, PTE_R | PTE_U) < 0 ||
+     mappages(pagetable, VDSOPROC, PGSIZE,
+              (uint64)p->mm->vdsoproc, PTE_R | PTE_U) < 0){
+    proc_freepagetable(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -198,7 +389,8 @@ void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, THREADFRAME(NTHREAD-1), NTHREAD, 0);
+  uvmunmap(pagetable, VDSOPROC, 2, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -220,22 +412,24 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if(fdtalloc(p, 0) < 0)
+    panic("userinit");
+  p->fdt->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
@@ -247,16 +441,26 @@ growproc(int n)
 {
   uint sz;
   struct proc *p = myproc();
+  struct mm *mm = p->mm;
 
-  sz = p->sz;
+  acquiresleep(&mm->lock);
+  sz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if((sz = uvmalloc(mm->pagetable, sz, sz + n)) == 0) {
+      releasesleep(&mm->lock);
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if((uint)-n > sz){
+      releasesleep(&mm->lock);
+      return -1;
+    }
+    if(PGROUNDUP(sz + n) < PGROUNDUP(sz))
+      mmunmap(mm, PGROUNDUP(sz + n), (PGROUNDUP(sz) - PGROUNDUP(sz + n)) / PGSIZE);
+    sz += n;
   }
-  p->sz = sz;
+  mm->sz = sz;
+  releasesleep(&mm->lock);
   return 0;
 }
 
@@ -265,24 +469,50 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // np stays UNUSED until setrunnable(), so nothing else
+  // touches it; don't hold its lock while waiting for the
+  // mm lock, which sleeps.
+  release(&np->lock);
+
+  // Copy user memory from parent to child; the parent's other
+  // threads, if any, must not change it meanwhile.
+  acquiresleep(&p->mm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0){
+    releasesleep(&p->mm->lock);
+    acquire(&np->lock);
+    freeproc(np);
+    return -1;
+  }
+  np->mm->sz = p->mm->sz;
+  np->nice = np->level = p->nice;
+  if(vmacopy(np, p) < 0){
+    releasesleep(&p->mm->lock);
+    acquire(&np->lock);
+    freeproc(np);
+    return -1;
+  }
+  releasesleep(&p->mm->lock);
+
+  // copy the open files and current directory.
+  if(fdtalloc(np, p->fdt) < 0){
+    acquire(&np->lock);
     freeproc(np);
-    release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
 
+  acquire(&wait_lock);
   np->parent = p;
+  childlink(&p->children, np);
+  release(&wait_lock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -290,47 +520,178 @@ fork(void)
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  acquire(&np->lock);
+  pid = np->pid;
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a thread that shares the current process's address
+// space, starting at fn(arg) on the user stack whose top is
+// stack. fn must not return; the thread ends by calling
+// exit(). The thread gets its own references to the open
+// files and current directory, as a fork()ed child does.
+// Returns the thread's pid, for join().
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // hold the mm lock to map the thread's trapframe.
+  acquiresleep(&p->mm->lock);
+  if((np = allocproc(p->mm)) == 0){
+    releasesleep(&p->mm->lock);
+    return -1;
+  }
+  // wait_lock comes before any p->lock.
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->thread = 1;
+  childlink(&p->threads, np);
+  release(&wait_lock);
+  np->nice = np->level = p->nice;
+
+  // start at fn(arg), with no return address.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0;
+
+  // share the open files and current directory.
+  fdtshare(np, p->fdt);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  acquire(&np->lock);
   pid = np->pid;
+  setrunnable(np);
+  release(&np->lock);
+  releasesleep(&p->mm->lock);
 
-  np->state = RUNNABLE;
+  return pid;
+}
 
+// Create a process running the program at path with
+// arguments argv, building its memory straight from the
+// program file instead of copying the caller's, as fork()
+// followed by exec() would. The child's file descriptors
+// 0..NSPAWNFD-1 are files[], any of which may be 0, and it
+// has no others. Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct file **files)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc(0)) == 0)
+    return -1;
+
+  // np stays UNUSED until setrunnable(), so nothing else
+  // touches it; don't hold its lock while loading the
+  // program, which sleeps.
+  release(&np->lock);
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = elfload(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+  np->nice = np->level = p->nice;
+
+  if(fdtalloc(np, 0) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    return -1;
+  }
+  for(i = 0; i < NSPAWNFD; i++)
+    if(files[i])
+      np->fdt->ofile[i] = filedup(files[i]);
+  np->fdt->cwd = fdtcwd();
+
+  acquire(&wait_lock);
+  np->parent = p;
+  childlink(&p->children, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  pid = np->pid;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Put child p on the list at head.
+// Caller must hold wait_lock.
+static void
+childlink(struct proc **head, struct proc *p)
+{
+  p->sibling = *head;
+  if(*head)
+    (*head)->sibprev = &p->sibling;
+  *head = p;
+  p->sibprev = head;
+}
+
+// Take child p off whichever list it is on.
+// Caller must hold wait_lock.
+static void
+childunlink(struct proc *p)
+{
+  *p->sibprev = p->sibling;
+  if(p->sibling)
+    p->sibling->sibprev = p->sibprev;
+  p->sibling = 0;
+  p->sibprev = 0;
+}
+
 // Pass p's abandoned children to init.
-// Caller must hold p->lock.
+// Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
+  int zombies = p->zombies != 0;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if(pp->parent == p){
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
+  while((pp = p->children) != 0){
+    childunlink(pp);
+    pp->parent = initproc;
+    childlink(&initproc->children, pp);
+  }
+  while((pp = p->zombies) != 0){
+    childunlink(pp);
+    pp->parent = initproc;
+    childlink(&initproc->zombies, pp);
+  }
+  while((pp = p->threads) != 0){
+    childunlink(pp);
+    pp->parent = initproc;
+    // no one is left to join() a thread; init will wait()
+    // for it. a process becomes a ZOMBIE only while holding
+    // wait_lock, so that is safe to look at here.
+    pp->thread = 0;
+    if(pp->state == ZOMBIE){
+      childlink(&initproc->zombies, pp);
+      zombies = 1;
+    } else {
+      childlink(&initproc->children, pp);
     }
   }
+
+  // init may have to wait() for a zombie it just got.
+  if(zombies)
+    wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -344,55 +705,29 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // Close all open files, unless other threads share them.
+  fdtput(p);
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
-
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
-  acquire(&initproc->lock);
-  wakeup1(initproc);
-  release(&initproc->lock);
-
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
-  struct proc *original_parent = p->parent;
-  release(&p->lock);
-  
-  // we need the parent's lock in order to wake it up from wait().
-  // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
+  mmput(p);
 
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
-  wakeup1(original_parent);
+  // Parent might be sleeping in wait() or join().
+  if(!p->thread){
+    childunlink(p);
+    childlink(&p->parent->zombies, p);
+  }
+  wakeup(p->parent);
+
+  acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&original_parent->lock);
+  release(&wait_lock);
 
   // Jump into the scheduler, never to return.
   sched();
@@ -405,58 +740,205 @@ int
 wait(uint64 addr)
 {
   struct proc *np;
-  int havekids, pid;
+  int pid;
   struct proc *p = myproc();
 
-  // hold p->lock for the whole time to avoid lost
+  // hold wait_lock for the whole time to avoid lost
   // wakeups from a child's exit().
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
-          release(&np->lock);
-          release(&p->lock);
-          return pid;
-        }
+    if((np = p->zombies) != 0){
+      // Found one.
+      acquire(&np->lock);
+      pid = np->pid;
+      if(addr != 0 && lockedcopyout(p->pagetable, addr, (char *)&np->xstate,
+                                    sizeof(np->xstate)) < 0) {
         release(&np->lock);
+        release(&wait_lock);
+        return -1;
       }
+      childunlink(np);
+      freeproc(np);
+      release(&wait_lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || p->killed){
-      release(&p->lock);
+    if(p->children == 0 || p->killed){
+      release(&wait_lock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &p->lock);  //DOC: wait-sleep
+    sleep(p, &wait_lock);  //DOC: wait-sleep
+  }
+}
+
+// Wait for the thread tid, made by this process's clone(), to
+// exit, and free it. Copies its exit status to addr if addr
+// is not 0. Returns tid, or -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // hold wait_lock for the whole time to avoid lost
+  // wakeups from the thread's exit().
+  acquire(&wait_lock);
+
+  for(;;){
+    acquire(&pid_lock);
+    if((np = pidlookup(tid)) != 0 && (np->parent != p || !np->thread))
+      np = 0;
+    release(&pid_lock);
+    if(np == 0 || p->killed){
+      release(&wait_lock);
+      return -1;
+    }
+
+    acquire(&np->lock);
+    if(np->state == ZOMBIE){
+      if(addr != 0 && lockedcopyout(p->pagetable, addr, (char *)&np->xstate,
+                                    sizeof(np->xstate)) < 0) {
+        release(&np->lock);
+        release(&wait_lock);
+        return -1;
+      }
+      childunlink(np);
+      freeproc(np);
+      release(&wait_lock);
+      return tid;
+    }
+    release(&np->lock);
+
+    // Wait for the thread to exit.
+    sleep(p, &wait_lock);
+  }
+}
+
+// Make p RUNNABLE and put it on the run queue for its
+// priority level of the hart it last ran on, whose caches
+// are most likely to hold its data, or of this hart if it
+// hasn't run yet.
+// Caller must hold p->lock.
+void
+setrunnable(struct proc *p)
+{
+  struct cpu *c;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  c = &cpus[p->hart >= 0 ? p->hart : cpuid()];
+
+  p->state = RUNNABLE;
+  acquire(&c->rqlock);
+  p->rqnext = 0;
+  if(c->rqtail[p->level])
+    c->rqtail[p->level]->rqnext = p;
+  else
+    c->rqhead[p->level] = p;
+  c->rqtail[p->level] = p;
+  c->rqlen++;
+  release(&c->rqlock);
+
+  // a hart parked in wfi won't look at its run queue until
+  // its timer goes off, which may be never. wake up c if it
+  // is idle, or else some idle hart that could steal p.
+  if(!c->idle){
+    for(c = cpus; c < &cpus[NCPU]; c++)
+      if(c->idle && c != mycpu())
+        break;
+  }
+  if(c < &cpus[NCPU] && c->idle && c != mycpu())
+    timerkick(c - cpus);
+}
+
+// Take the oldest process of the highest priority off c's
+// run queues, or return 0. First apply any priority boost
+// the queues haven't seen, by moving every process to the
+// top queue; the scheduler resets its level when it runs.
+static struct proc*
+runqget(struct cpu *c)
+{
+  struct proc *p = 0;
+  int l;
+
+  acquire(&c->rqlock);
+  if(c->epoch != schedepoch){
+    for(l = 1; l < NMLFQ; l++){
+      if(c->rqhead[l] == 0)
+        continue;
+      if(c->rqtail[0])
+        c->rqtail[0]->rqnext = c->rqhead[l];
+      else
+        c->rqhead[0] = c->rqhead[l];
+      c->rqtail[0] = c->rqtail[l];
+      c->rqhead[l] = c->rqtail[l] = 0;
+    }
+    c->epoch = schedepoch;
+  }
+  for(l = 0; l < NMLFQ; l++){
+    if((p = c->rqhead[l]) != 0){
+      c->rqhead[l] = p->rqnext;
+      if(c->rqhead[l] == 0)
+        c->rqtail[l] = 0;
+      c->rqlen--;
+      p->rqnext = 0;
+      break;
+    }
+  }
+  release(&c->rqlock);
+  return p;
+}
+
+// Find a process for this hart to run: the next one on its
+// own run queues, or if they're empty, one stolen from the
+// hart with the most waiting.
+static struct proc*
+runqnext(void)
+{
+  struct cpu *c = mycpu(), *c1, *victim;
+  struct proc *p;
+
+  if((p = runqget(c)) != 0)
+    return p;
+
+  // rqlen is read without locks; it is only a hint.
+  victim = 0;
+  for(c1 = cpus; c1 < &cpus[NCPU]; c1++)
+    if(c1 != c && c1->rqlen > 0 && (victim == 0 || c1->rqlen > victim->rqlen))
+      victim = c1;
+  if(victim)
+    return runqget(victim);
+  return 0;
+}
+
+// Start a new priority-boost epoch. Called by clockintr().
+void
+schedboost(void)
+{
+  __sync_fetch_and_add(&schedepoch, 1);
+}
+
+// Catch p up with the latest priority boost.
+// Caller must hold p->lock.
+static void
+boostproc(struct proc *p)
+{
+  if(p->epoch != schedepoch){
+    p->level = p->nice;
+    p->runticks = 0;
+    p->epoch = schedepoch;
   }
 }
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run from its run queue,
+//    or steal one from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -470,31 +952,60 @@ scheduler(void)
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
-    
-    int nproc = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state != UNUSED) {
-        nproc++;
-      }
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+
+    // with nothing to run, stop the tick and wait in wfi for
+    // a deadline or for setrunnable() to kick this hart. the
+    // run queues are looked at again after the timer is armed,
+    // and with interrupts off, so that a kick can't be lost.
+    intr_off();
+    if((p = runqnext()) == 0){
+      if(!c->idle){
+        c->idle = 1;
+        timerarm();
+      } else {
+        asm volatile("wfi");
       }
-      release(&p->lock);
+      continue;
     }
-    if(nproc <= 2) {   // only init and sh exist
-      intr_on();
-      asm volatile("wfi");
+    if(c->idle){
+      c->idle = 0;
+      timerarm();
     }
+
+    // p left its run queue RUNNABLE, and only a scheduler
+    // changes that; but the hart that queued it may still
+    // be switching away from it, holding p->lock.
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      boostproc(p);
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      c->proc = p;
+      // p's kernel stack may be in a slot that a process
+      // that ran here before had, and the TLB may still
+      // hold that process's stack.
+      if(p->hart != cpuid())
+        sfence_vma_va(p->kstack);
+      // this hart's TLB may hold stale translations for p's
+      // ASID from when p last ran here, or from a process
+      // that had the ASID before.
+      // likewise if another thread of p has unmapped pages.
+      // (p has no mm if preempted in exit().)
+      if(p->mm && (p->hart != cpuid() || p->flushgen != p->mm->flushgen)){
+        if(p->mm->asid)
+          sfence_vma_asid(p->mm->asid);
+        p->hart = cpuid();
+        p->flushgen = p->mm->flushgen;
+      }
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+    }
+    release(&p->lock);
   }
 }
 
@@ -525,13 +1036,44 @@ sched(void)
   mycpu()->intena = intena;
 }
 
+// Charge a timer tick to the current process, and give up
+// the CPU if it has used up its time slice, moving it down
+// a level, or if a process of higher priority is waiting.
+// Called on each timer interrupt in place of yield().
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int l, preempt = 0;
+
+  acquire(&p->lock);
+  boostproc(p);
+  if(++p->runticks >= MLFQSLICE(p->level)){
+    if(p->level < NMLFQ-1)
+      p->level++;
+    p->runticks = 0;
+    preempt = 1;
+  } else {
+    c = mycpu();
+    for(l = 0; l < p->level; l++)
+      if(c->rqhead[l])  // racy, but only a hint
+        preempt = 1;
+  }
+  if(preempt){
+    setrunnable(p);
+    sched();
+  }
+  release(&p->lock);
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -557,38 +1099,107 @@ forkret(void)
   usertrapret();
 }
 
+static struct sleepq*
+sleepqof(void *chan)
+{
+  return &sleepq[((uint64)chan >> 3) % NSLEEPQ];
+}
+
+// Take p off its wait queue, if it is on one.
+static void
+sleepqremove(struct proc *p)
+{
+  struct sleepq *q = p->wq;
+  struct proc **pp;
+
+  if(q == 0)
+    return;
+  for(pp = &q->head; *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      break;
+    }
+  }
+  p->wq = 0;
+  p->wqnext = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
+// lk must not be p->lock, which comes after the queue's lock.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
-  
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
-    acquire(&p->lock);  //DOC: sleeplock1
-    release(lk);
-  }
+  struct sleepq *q = sleepqof(chan);
+  struct proc **pp;
+
+  if(lk == &p->lock)
+    panic("sleep p->lock");
+
+  // Join the queue before releasing lk, so that a waker,
+  // which must hold lk or have changed the condition under
+  // it, will find p there. Must acquire p->lock in order to
+  // change p->state and then call sched; a waker takes
+  // p->lock before looking at p->state, so it can't see p
+  // until p is asleep.
+  acquire(&q->lock);  //DOC: sleeplock0
+  acquire(&p->lock);  //DOC: sleeplock1
+  for(pp = &q->head; *pp; pp = &(*pp)->wqnext)
+    ;
+  *pp = p;
+  p->wqnext = 0;
+  p->wq = q;
+  p->chan = chan;
+  release(&q->lock);
+  release(lk);
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
 
   sched();
 
-  // Tidy up.
+  // Tidy up. wakeup() takes p off the queue, but kill()
+  // doesn't. p->lock must be dropped to take the queue's.
+  release(&p->lock);
+  acquire(&q->lock);
+  acquire(&p->lock);
+  sleepqremove(p);
   p->chan = 0;
+  release(&p->lock);
+  release(&q->lock);
 
   // Reacquire original lock.
-  if(lk != &p->lock){
+  acquire(lk);
+}
+
+// Wake up processes sleeping on chan, longest asleep first:
+// all of them, or if max > 0, at most max.
+// Returns the number woken.
+// The queue's lock is held throughout, so no sleeper on it
+// can take itself off and be freed while wakeup looks at it.
+static int
+wakeupq(void *chan, int max)
+{
+  struct sleepq *q = sleepqof(chan);
+  struct proc *p, *next;
+  int n = 0;
+
+  acquire(&q->lock);
+  for(p = q->head; p && (max <= 0 || n < max); p = next){
+    next = p->wqnext;
+    if(p->chan != chan)
+      continue;
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan){
+      sleepqremove(p);
+      setrunnable(p);
+      n++;
+    }
     release(&p->lock);
-    acquire(lk);
   }
+  release(&q->lock);
+  return n;
 }
 
 // Wake up all processes sleeping on chan.
@@ -596,27 +1207,28 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeupq(chan, 0);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
-    }
-    release(&p->lock);
-  }
+// Wake up just one process sleeping on chan, such as the next
+// waiter for a lock that is being handed on; waking them all
+// would only have the rest go straight back to sleep.
+// Must be called without any p->lock.
+void
+wakeone(void *chan)
+{
+  wakeupq(chan, 1);
 }
 
-// Wake up p if it is sleeping in wait(); used by exit().
-// Caller must hold p->lock.
-static void
-wakeup1(struct proc *p)
+// Wake up at most n processes sleeping on chan, for
+// futex_wake(). Returns the number woken.
+// Must be called without any p->lock.
+int
+wakeupn(void *chan, int n)
 {
-  if(!holding(&p->lock))
-    panic("wakeup1");
-  if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
-  }
+  if(n <= 0)
+    return 0;
+  return wakeupq(chan, n);
 }
 
 // Kill the process with the given pid.
@@ -627,31 +1239,55 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
+  acquire(&pid_lock);
+  if((p = pidlookup(pid)) != 0){
     acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
+    p->killed = 1;
+    if(p->state == SLEEPING){
+      // Wake process from sleep().
+      setrunnable(p);
     }
     release(&p->lock);
   }
-  return -1;
+  release(&pid_lock);
+  return p ? 0 : -1;
+}
+
+// Set the nice level of the process with the given pid: the
+// highest priority level it may run at, from 0 (the default)
+// to NMLFQ-1. Returns 0, or -1 if there is no such process.
+int
+setnice(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < 0)
+    nice = 0;
+  if(nice > NMLFQ-1)
+    nice = NMLFQ-1;
+  acquire(&pid_lock);
+  if((p = pidlookup(pid)) != 0){
+    acquire(&p->lock);
+    p->nice = nice;
+    // takes effect when p next queues or is boosted.
+    if(p->level < nice && p->state != RUNNABLE)
+      p->level = nice;
+    release(&p->lock);
+  }
+  release(&pid_lock);
+  return p ? 0 : -1;
 }
 
 // Copy to either a user address, or kernel address,
-// depending on usr_dst.
+// depending on usr_dst. For readi() and the like, which
+// hold an inode lock; see lockedcopyout().
 // Returns 0 on success, -1 on error.
 int
 either_copyout(int user_dst, uint64 dst, void *src, uint64 len)
 {
   struct proc *p = myproc();
   if(user_dst){
-    return copyout(p->pagetable, dst, src, len);
+    return lockedcopyout(p->pagetable, dst, src, len);
   } else {
     memmove((char *)dst, src, len);
     return 0;
@@ -666,7 +1302,7 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 {
   struct proc *p = myproc();
   if(user_src){
-    return copyin(p->pagetable, dst, src, len);
+    return lockedcopyin(p->pagetable, dst, src, len);
   } else {
     memmove(dst, (char*)src, len);
     return 0;
@@ -688,16 +1324,19 @@ procdump(void)
   };
   struct proc *p;
   char *state;
+  int i;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+  for(i = 0; i < NPIDHASH; i++){
+    for(p = pidhash[i]; p; p = p->pidnext){
+      if(p->state == UNUSED)
+        continue;
+      if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+        state = states[p->state];
+      else
+        state = "???";
+      printf("%d %s %s", p->pid, state, p->name);
+      printf("\n");
+    }
   }
 }
@@ -1,3 +1,5 @@
+struct sleepq;
+
 // Saved registers for kernel context switches.
 struct context {
   uint64 ra;
@@ -24,6 +26,17 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+
+  // RUNNABLE processes waiting for this cpu, one queue
+  // per priority level, each oldest first.
+  struct spinlock rqlock;
+  struct proc *rqhead[NMLFQ];
+  struct proc *rqtail[NMLFQ];
+  int rqlen;                  // total over all levels
+  uint epoch;                 // last priority boost applied to queues
+
+  int idle;                   // Parked in the scheduler with nothing to run?
+  uint tick;                  // Last tick this cpu's timer saw
 };
 
 extern struct cpu cpus[NCPU];
@@ -78,6 +91,7 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 kernel_fast;   // usertrapfast()
 };
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
@@ -88,19 +102,50 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int hart;                    // Hart p last ran on, or -1
+  int level;                   // Priority level; 0 is highest
+  int nice;                    // Highest level p may run at
+  int runticks;                // Ticks run at this level
+  uint epoch;                  // Last priority boost p has seen
+
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process
+  int thread;                  // Made by clone(); reaped by join(), not wait()
+  struct proc *children;       // Running children, not threads
+  struct proc *zombies;        // Exited children for wait() to reap
+  struct proc *threads;        // Threads made by clone(), running or not
+  struct proc *sibling;        // Next on the parent's list
+  struct proc **sibprev;       // What points to p on the parent's list
+
+  // pid_lock must be held when using this:
+  struct proc *pidnext;        // Next process on pid hash chain
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next RUNNABLE process on run queue
+
+  // the wait queue's lock must be held when using these:
+  struct sleepq *wq;           // Wait queue p sleeps on, or 0
+  struct proc *wqnext;         // Next sleeper on the wait queue
+
+  // the timers lock must be held when using these:
+  uint64 wakeat;               // Deadline in time-register cycles
+  int tmidx;                   // Index in the timer heap, or -1
+  int woken;                   // timerwake() called since timerwaitstart()
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct mm *mm;               // Address space, maybe shared with threads
+  pagetable_t pagetable;       // User page table, the same as mm->pagetable
+  uint flushgen;               // mm->flushgen when p's hart last flushed
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // where trapframe is mapped in user space
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct fdtable *fdt;         // Open files and cwd, maybe shared with threads
+  struct file *fdheld[2];      // Files fdget() holds for this system call
+  int nfdheld;
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,133 @@
+//
+// Sampling profiler.
+//
+// While profiling is on, a hart that is running a process
+// takes a timer interrupt every PROFCYCLES as well as every
+// tick (see timerarm()), and each timer interrupt records the
+// interrupted pc in a ring of the hart's own, along with the
+// process's pid, parent and name. profread() hands the samples
+// to user space, where prof picks out the ones belonging to
+// the command it ran and symbolizes them.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "prof.h"
+#include "defs.h"
+
+struct profring {
+  struct spinlock lock;
+  struct profsample s[NPROFSAMPLES];
+  uint n;      // samples taken; the next goes in s[n % NPROFSAMPLES]
+  uint r;      // samples read or overwritten
+};
+
+struct profring profrings[NCPU];
+extern struct spinlock wait_lock;
+int profiling;  // read without a lock by timerarm() and profsample()
+
+void
+profinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&profrings[i].lock, "prof");
+}
+
+// Start profiling, forgetting any samples not yet read.
+void
+profstart(void)
+{
+  struct profring *pr;
+
+  for(pr = profrings; pr < &profrings[NCPU]; pr++){
+    acquire(&pr->lock);
+    pr->n = pr->r = 0;
+    release(&pr->lock);
+  }
+  __sync_synchronize();
+  profiling = 1;
+}
+
+void
+profstop(void)
+{
+  profiling = 0;
+  __sync_synchronize();
+}
+
+// Record the pc that this hart's timer interrupt interrupted.
+// Called by devintr(), so sepc and sstatus's SPP still
+// describe the interrupted code.
+void
+profsample(void)
+{
+  struct profring *pr;
+  struct profsample *s;
+  struct proc *p;
+  int ppid;
+
+  if(!profiling)
+    return;
+  p = myproc();
+  ppid = 0;
+  if(p){
+    // the parent may exit and be freed at any time. This hart
+    // can't already hold wait_lock, since interrupts are off
+    // while it holds a spin lock.
+    acquire(&wait_lock);
+    if(p->parent)
+      ppid = p->parent->pid;
+    release(&wait_lock);
+  }
+  pr = &profrings[cpuid()];
+  acquire(&pr->lock);
+  s = &pr->s[pr->n++ % NPROFSAMPLES];
+  s->pc = r_sepc();
+  if(p){
+    s->pid = p->pid;
+    s->ppid = ppid;
+    memmove(s->name, p->name, sizeof(s->name));
+  } else {
+    s->pid = s->ppid = 0;
+    s->name[0] = 0;
+  }
+  s->user = (r_sstatus() & SSTATUS_SPP) == 0;
+  if(pr->n - pr->r > NPROFSAMPLES)
+    pr->r = pr->n - NPROFSAMPLES;  // overwrote the oldest
+  release(&pr->lock);
+}
+
+// Copy up to n samples that haven't been read yet, from all
+// harts, to the user address addr.
+// Returns the number copied, or -1.
+int
+profread(uint64 addr, int n)
+{
+  struct profsample buf[32];
+  struct profring *pr;
+  int tot, m;
+
+  tot = 0;
+  for(pr = profrings; pr < &profrings[NCPU] && tot < n; pr++){
+    for(;;){
+      // copy out without the lock, since copyout() may sleep.
+      acquire(&pr->lock);
+      for(m = 0; m < NELEM(buf) && tot + m < n && pr->r != pr->n; m++)
+        buf[m] = pr->s[pr->r++ % NPROFSAMPLES];
+      release(&pr->lock);
+      if(m == 0)
+        break;
+      if(copyout(myproc()->pagetable, addr + tot*sizeof(buf[0]),
+                 (char*)buf, m*sizeof(buf[0])) < 0)
+        return -1;
+      tot += m;
+    }
+  }
+  return tot;
+}
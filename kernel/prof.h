@@ -0,0 +1,13 @@
+// One sample from the profiler; see profctl().
+struct profsample {
+  uint64 pc;     // interrupted pc
+  int pid;       // process running, or 0 for none
+  int ppid;      // its parent's pid, or 0
+  int user;      // pc is a user address in pid
+  char name[16]; // its name, as exec() set it
+};
+
+// profctl() commands
+#define PROF_STOP  0
+#define PROF_START 1
+#define PROF_READ  2
@@ -3,8 +3,11 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "mm.h"
 #include "syscall.h"
+#include "sysstat.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
@@ -12,7 +15,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -106,6 +109,30 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 // lab9 q2
 extern uint64 sys_symlink(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_nice(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_clock_gettime(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_tee(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_io_enter(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_logmode(void);
+extern uint64 sys_sysstat(void);
+extern uint64 sys_profctl(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,20 +157,104 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_symlink]   sys_symlink,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_nice]    sys_nice,
+[SYS_setpriority] sys_setpriority,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_spawn]   sys_spawn,
+[SYS_splice]  sys_splice,
+[SYS_tee]     sys_tee,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_io_enter] sys_io_enter,
+[SYS_poll]    sys_poll,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_logmode] sys_logmode,
+[SYS_sysstat] sys_sysstat,
+[SYS_profctl] sys_profctl,
 };
 
+// Each hart counts the system calls that return on it in an
+// array of its own, so that counting needs no lock; sysstat()
+// adds them up. A call that sleeps may return on another hart
+// than it started on; its latency includes the sleep.
+struct sysstat sysstats[NCPU][NELEM(syscalls)];
+
+static void
+sysstatadd(int num, uint64 t)
+{
+  struct sysstat *st;
+  int b;
+
+  push_off();
+  st = &sysstats[cpuid()][num];
+  st->count++;
+  st->cycles += t;
+  for(b = 0; b < NSYSHIST-1 && (t >> (b+1)) != 0; b++)
+    ;
+  st->hist[b]++;
+  pop_off();
+}
+
 void
 syscall(void)
 {
   int num;
   struct proc *p = myproc();
+  uint64 t0;
 
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    t0 = r_time();
     p->trapframe->a0 = syscalls[num]();
+    fdrelease();
+    sysstatadd(num, r_time() - t0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
     p->trapframe->a0 = -1;
   }
 }
+
+// sysstat(st, n): copy the statistics of system calls 0..n-1,
+// summed over harts, to st[0..n-1], or reset them all if st
+// is 0. The figures may be a little off while other harts
+// are making system calls.
+// Returns the number of system calls there are statistics
+// for, or -1.
+uint64
+sys_sysstat(void)
+{
+  struct sysstat sum;
+  uint64 ust;
+  int n, num, i, b;
+
+  if(argaddr(0, &ust) < 0 || argint(1, &n) < 0)
+    return -1;
+  if(ust == 0){
+    memset(sysstats, 0, sizeof(sysstats));
+    return NELEM(syscalls);
+  }
+  for(num = 0; num < n && num < NELEM(syscalls); num++){
+    memset(&sum, 0, sizeof(sum));
+    for(i = 0; i < NCPU; i++){
+      sum.count += sysstats[i][num].count;
+      sum.cycles += sysstats[i][num].cycles;
+      for(b = 0; b < NSYSHIST; b++)
+        sum.hist[b] += sysstats[i][num].hist[b];
+    }
+    if(copyout(myproc()->pagetable, ust + num*sizeof(sum),
+               (char*)&sum, sizeof(sum)) < 0)
+      return -1;
+  }
+  return NELEM(syscalls);
+}
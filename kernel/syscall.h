@@ -21,4 +21,33 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 // lab9 q2
-#define SYS_symlink  22
\ No newline at end of file
+#define SYS_symlink  22
+#define SYS_mmap    23
+#define SYS_munmap  24
+#define SYS_nice    25
+#define SYS_setpriority 26
+#define SYS_nanosleep 27
+#define SYS_clock_gettime 28
+#define SYS_clone   29
+#define SYS_join    30
+#define SYS_futex_wait 31
+#define SYS_futex_wake 32
+#define SYS_spawn   33
+#define SYS_splice  34
+#define SYS_tee     35
+#define SYS_readv   36
+#define SYS_writev  37
+#define SYS_pread   38
+#define SYS_pwrite  39
+#define SYS_io_enter 40
+#define SYS_poll    41
+#define SYS_fsync   42
+#define SYS_fdatasync 43
+#define SYS_logmode 44
+#define SYS_sysstat 45
+#define SYS_profctl 46
+
+// system calls that trampoline.S sends to usertrapfast(),
+// saving only the registers a C function may change: ones
+// that never sleep and look at no registers but a0-a7.
+#define FASTSYSCALLS ((1 << SYS_getpid) | (1 << SYS_uptime))
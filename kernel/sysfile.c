@@ -13,8 +13,13 @@
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
+#include "mm.h"
 #include "file.h"
+#include "fdtable.h"
 #include "fcntl.h"
+#include "ioring.h"
+#include "poll.h"
+#include "memlayout.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -26,7 +31,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdget(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -41,17 +46,38 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct fdtable *fdt = myproc()->fdt;
 
+  acquire(&fdt->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(fdt->ofile[fd] == 0){
+      fdt->ofile[fd] = f;
+      release(&fdt->lock);
       return fd;
     }
   }
+  release(&fdt->lock);
   return -1;
 }
 
+// Take fd out of the file descriptor table.
+// Returns its file, whose reference the caller takes over,
+// or 0 if fd isn't open.
+static struct file*
+fdfree(int fd)
+{
+  struct fdtable *fdt = myproc()->fdt;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&fdt->lock);
+  f = fdt->ofile[fd];
+  fdt->ofile[fd] = 0;
+  release(&fdt->lock);
+  return f;
+}
+
 uint64
 sys_dup(void)
 {
@@ -75,9 +101,92 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  // fault in the buffer now, since pipes and the console
+  // copy to it holding a spin-lock, and readi() holding
+  // the lock of an inode that might be the buffer's file.
+  if(n > 0)
+    vmaprefault(myproc(), p, n, 1);
   return fileread(f, p, n);
 }
 
+// Fetch the array of cnt iovecs at user address uiov into
+// iov[NIOV], and fault in the buffers, as sys_read() does.
+// Returns 0, or -1 if there are too many, or too many bytes.
+static int
+fetchiov(uint64 uiov, int cnt, struct iovec *iov, int write)
+{
+  uint64 tot;
+  int i;
+
+  if(cnt < 0 || cnt > NIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, cnt*sizeof(iov[0])) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].iov_len > 0x7fffffff || (tot += iov[i].iov_len) > 0x7fffffff)
+      return -1;
+    if(iov[i].iov_len > 0)
+      vmaprefault(myproc(), (uint64)iov[i].iov_base, iov[i].iov_len, write);
+  }
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+  uint64 uiov;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &uiov) < 0 || argint(2, &cnt) < 0)
+    return -1;
+  if(fetchiov(uiov, cnt, iov, 1) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  if(n > 0)
+    vmaprefault(myproc(), p, n, 1);
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(fin, fout, n);
+}
+
+uint64
+sys_tee(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filetee(fin, fout, n);
+}
+
 uint64
 sys_write(void)
 {
@@ -87,19 +196,87 @@ sys_write(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  // see sys_read().
+  if(n > 0)
+    vmaprefault(myproc(), p, n, 0);
 
   return filewrite(f, p, n);
 }
 
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+  uint64 uiov;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &uiov) < 0 || argint(2, &cnt) < 0)
+    return -1;
+  if(fetchiov(uiov, cnt, iov, 0) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  if(n > 0)
+    vmaprefault(myproc(), p, n, 0);
+  return filewritev(f, &iov, 1, off);
+}
+
+// fsync(fd): wait until fd's file is safe on disk. The log
+// commits every file's writes at once, so this commits any
+// open transaction; see logmode().
+uint64
+sys_fsync(void)
+{
+  if(argfd(0, 0, 0) < 0)
+    return -1;
+  logflush();
+  return 0;
+}
+
+// fdatasync(fd): like fsync(); the log can't commit a file's
+// data apart from its metadata.
+uint64
+sys_fdatasync(void)
+{
+  return sys_fsync();
+}
+
+// logmode(batch): with batch 0, the default, every file
+// system call's writes are on disk when it returns; with 1,
+// they may be held until fsync(). Returns the previous mode.
+uint64
+sys_logmode(void)
+{
+  int batch;
+
+  if(argint(0, &batch) < 0)
+    return -1;
+  return logmode(batch);
+}
+
 uint64
 sys_close(void)
 {
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0 || (f = fdfree(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -326,17 +503,15 @@ sys_symlink(void)
 // If the file does not exist, open must fail.
 // When a process specifies O_NOFOLLOW in the flags to open, open should open the symlink (and not follow the symbolic link).
 // open()“打开一个文件”，就是在SFT里找到一个空的struct file，向这项里写入需要的数据，再把这项的指针送入ofile，返回这个指针再ofile里的下标，把这个下标作为文件描述符返回。
-uint64
-sys_open(void)
+//
+// Used by sys_open() and io_enter(); returns the new file
+// descriptor, or -1.
+static int
+fdopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -426,6 +601,17 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return fdopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -466,8 +652,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct fdtable *fdt = myproc()->fdt;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -481,25 +667,26 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&fdt->lock);
+  old = fdt->cwd;
+  fdt->cwd = ip;
+  release(&fdt->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Copy the user argument vector at uargv into argv[MAXARG],
+// a page per string. Returns 0, or -1 having freed them.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -515,18 +702,80 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
+
+ bad:
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+  return -1;
+}
 
-  int ret = exec(path, argv);
+static void
+freeargv(char **argv)
+{
+  int i;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
 
+  ret = exec(path, argv);
+
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fds): fds, if not 0, points to NSPAWNFD
+// of the caller's file descriptors to give the child as its
+// 0, 1 and 2, with -1 for none. Otherwise the child gets the
+// caller's 0, 1 and 2.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int fds[NSPAWNFD], i, ret;
+  struct file *files[NSPAWNFD];
+  struct proc *p = myproc();
+  uint64 uargv, ufds;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &ufds) < 0)
+    return -1;
+  for(i = 0; i < NSPAWNFD; i++)
+    fds[i] = i;
+  if(ufds != 0 && copyin(p->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+    return -1;
+  // hold references, since another thread may close the fds.
+  ret = -1;
+  for(i = 0; i < NSPAWNFD; i++){
+    files[i] = 0;
+    if(fds[i] >= 0 && (files[i] = fddup(fds[i])) == 0 && ufds != 0)
+      goto bad;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    goto bad;
+
+  ret = spawn(path, argv, files);
+
+  freeargv(argv);
+bad:
+  while(--i >= 0)
+    if(files[i])
+      fileclose(files[i]);
+  return ret;
 }
 
 uint64
@@ -544,18 +793,257 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdfree(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdfree(fd0);
+    fdfree(fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+// mmap(addr, len, prot, flags, fd, off)
+// Map len bytes of the file open as fd, starting at off, or
+// of zeroed memory if flags has MAP_ANONYMOUS. The kernel
+// picks the address; addr is only a hint and is ignored.
+// Returns the address, or -1.
+uint64
+sys_mmap(void)
+{
+  uint64 addr;
+  int len, prot, flags, fd, off;
+  struct file *f = 0;
+  struct proc *p = myproc();
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(argfd(4, &fd, &f) < 0)
+      return -1;
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  len = PGROUNDUP(len);
+  acquiresleep(&p->mm->lock);
+  if((addr = vmaspace(p, len)) == 0 ||
+     vmamap(p, addr, len, prot, flags, f ? f->ip : 0, off) < 0)
+    addr = -1;
+  releasesleep(&p->mm->lock);
+  return addr;
+}
+
+// munmap(addr, len)
+// Unmap the pages of [addr, addr+len) that mmap() mapped,
+// writing MAP_SHARED pages back to the file.
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len, r;
+  struct proc *p = myproc();
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  if(addr % PGSIZE != 0 || len <= 0)
+    return -1;
+  acquiresleep(&p->mm->lock);
+  r = vmaunmap(p, addr, PGROUNDUP(len));
+  releasesleep(&p->mm->lock);
+  return r;
+}
+
+// Carry out one io_enter() request, as the system call it
+// names would.
+static int
+iodo(struct io_sqe *sqe)
+{
+  struct proc *p = myproc();
+  char path[MAXPATH];
+  struct iovec iov;
+  struct file *f;
+  int r;
+
+  if(sqe->op == IO_NOP)
+    return 0;
+  if(sqe->op == IO_OPEN){
+    if(copyinstr(p->pagetable, path, sqe->addr, MAXPATH) < 0)
+      return -1;
+    return fdopen(path, sqe->len);
+  }
+  if(sqe->op == IO_CLOSE){
+    if((f = fdfree(sqe->fd)) == 0)
+      return -1;
+    fileclose(f);
+    return 0;
+  }
+  // a request may outlast another thread's close of fd.
+  if((f = fddup(sqe->fd)) == 0)
+    return -1;
+  r = -1;
+  switch(sqe->op){
+  case IO_READ:
+  case IO_WRITE:
+    if(sqe->len < 0 || sqe->off < -1)
+      break;
+    iov.iov_base = (void*)sqe->addr;
+    iov.iov_len = sqe->len;
+    // see sys_read().
+    if(sqe->len > 0)
+      vmaprefault(p, sqe->addr, sqe->len, sqe->op == IO_READ);
+    if(sqe->op == IO_READ)
+      r = filereadv(f, &iov, 1, sqe->off);
+    else
+      r = filewritev(f, &iov, 1, sqe->off);
+    break;
+  case IO_FSYNC:
+    logflush();
+    r = 0;
+    break;
+  }
+  fileclose(f);
+  return r;
+}
+
+// io_enter(ring, n): carry out up to n of the requests queued
+// in the io_ring at user address ring, in order, stopping
+// early if the completion queue fills up.
+// Returns the number of requests taken, or -1.
+uint64
+sys_io_enter(void)
+{
+  struct proc *p = myproc();
+  struct io_ring *r;  // a user address; not to be dereferenced
+  struct io_sqe sqe;
+  struct io_cqe cqe;
+  uint sqhead, sqtail, cqhead, cqtail;
+  uint64 ur;
+  int n, i;
+
+  if(argaddr(0, &ur) < 0 || argint(1, &n) < 0)
+    return -1;
+  r = (struct io_ring*)ur;
+  if(copyin(p->pagetable, (char*)&sqhead, (uint64)&r->sqhead, sizeof(uint)) < 0 ||
+     copyin(p->pagetable, (char*)&sqtail, (uint64)&r->sqtail, sizeof(uint)) < 0 ||
+     copyin(p->pagetable, (char*)&cqhead, (uint64)&r->cqhead, sizeof(uint)) < 0 ||
+     copyin(p->pagetable, (char*)&cqtail, (uint64)&r->cqtail, sizeof(uint)) < 0)
+    return -1;
+  for(i = 0; i < n && sqhead != sqtail; i++){
+    if(cqtail - cqhead >= IORING_SIZE || p->killed)
+      break;
+    if(copyin(p->pagetable, (char*)&sqe,
+              (uint64)&r->sq[sqhead % IORING_SIZE], sizeof(sqe)) < 0)
+      return -1;
+    sqhead++;
+    cqe.data = sqe.data;
+    cqe.res = iodo(&sqe);
+    cqe.pad = 0;
+    if(copyout(p->pagetable, (uint64)&r->cq[cqtail % IORING_SIZE],
+               (char*)&cqe, sizeof(cqe)) < 0)
+      return -1;
+    cqtail++;
+    // publish each completion as it is made, so the process
+    // sees them even if a later request fails.
+    if(copyout(p->pagetable, (uint64)&r->sqhead, (char*)&sqhead, sizeof(uint)) < 0 ||
+       copyout(p->pagetable, (uint64)&r->cqtail, (char*)&cqtail, sizeof(uint)) < 0)
+      return -1;
+  }
+  return i;
+}
+
+// poll(fds, n, timeout): wait until one of the n files in
+// fds[] is ready for the events asked for, or timeout
+// milliseconds pass; forever if timeout is -1. Each file that
+// isn't ready puts a pollent (or two, for a device with
+// separate input and output queues) on the queue of the pipe
+// or device it waits on, and after a wakeup only the files whose
+// pollents were woken are looked at again.
+// Returns the number of fds[] with revents set, or -1.
+uint64
+sys_poll(void)
+{
+  struct proc *p = myproc();
+  struct pollfd fds[NOFILE];
+  struct pollent pe[NOFILE], pe2[NOFILE];
+  struct file *f[NOFILE];
+  uint64 ufds, deadline;
+  int n, timeout, i, nready, r;
+
+  if(argaddr(0, &ufds) < 0 || argint(1, &n) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, ufds, n*sizeof(fds[0])) < 0)
+    return -1;
+  deadline = 0;
+  if(timeout >= 0)
+    deadline = r_time() + (uint64)timeout * 1000000 / NSPERCYCLE + 1;
+
+  timerwaitstart();
+  nready = 0;
+  for(i = 0; i < n; i++){
+    pe[i].proc = pe2[i].proc = p;
+    pe[i].ready = pe2[i].ready = 0;
+    pe[i].q = pe2[i].q = 0;
+    pe[i].also = &pe2[i];
+    pe2[i].also = 0;
+    fds[i].revents = 0;
+    f[i] = 0;
+    if(fds[i].fd < 0)
+      continue;
+    // hold on to the file, and so its pipe, while pe[i]
+    // may be queued there, in case another thread closes fd.
+    if((f[i] = fddup(fds[i].fd)) == 0){
+      fds[i].revents = POLLNVAL;
+    } else {
+      fds[i].revents = filepoll(f[i], fds[i].events, &pe[i]);
+    }
+    if(fds[i].revents)
+      nready++;
+  }
+
+  r = 0;
+  while(nready == 0 && timeout != 0){
+    if((r = timerwait(deadline)) < 0)
+      break;
+    timerwaitstart();
+    for(i = 0; i < n; i++){
+      // ready is only a hint; filepoll() looks under the
+      // pipe's or device's lock.
+      if(f[i] && (pe[i].ready || pe2[i].ready)){
+        if((fds[i].revents = filepoll(f[i], fds[i].events, &pe[i])) != 0)
+          nready++;
+      }
+    }
+    if(deadline && r_time() >= deadline)
+      break;
+  }
+
+  for(i = 0; i < n; i++){
+    if(f[i]){
+      polldel(&pe[i]);
+      polldel(&pe2[i]);
+      fileclose(f[i]);
+    }
+  }
+  if(r < 0)
+    return -1;
+  if(copyout(p->pagetable, ufds, (char*)fds, n*sizeof(fds[0])) < 0)
+    return -1;
+  return nready;
+}
@@ -5,7 +5,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "mm.h"
+#include "prof.h"
 
 uint64
 sys_exit(void)
@@ -35,9 +38,85 @@ sys_wait(void)
   uint64 p;
   if(argaddr(0, &p) < 0)
     return -1;
+  // wait() copies out the status holding p->lock.
+  if(p != 0)
+    vmaprefault(myproc(), p, sizeof(int), 1);
   return wait(p);
 }
 
+// clone(fn, arg, stack)
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  // join() copies out the status holding p->lock.
+  if(p != 0)
+    vmaprefault(myproc(), p, sizeof(int), 1);
+  return join(tid, p);
+}
+
+// futex_wait(addr, val)
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+// futex_wake(addr, n)
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
+// profctl(cmd, buf, n)
+uint64
+sys_profctl(void)
+{
+  int cmd, n;
+  uint64 buf;
+
+  if(argint(0, &cmd) < 0 || argaddr(1, &buf) < 0 || argint(2, &n) < 0)
+    return -1;
+  switch(cmd){
+  case PROF_STOP:
+    profstop();
+    return 0;
+  case PROF_START:
+    profstart();
+    return 0;
+  case PROF_READ:
+    if(n < 0)
+      return -1;
+    return profread(buf, n);
+  }
+  return -1;
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -46,7 +125,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
+  addr = myproc()->mm->sz;
   if(growproc(n) < 0)
     return -1;
   return addr;
@@ -56,20 +135,37 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
+  if(n < 0)
+    n = 0;
+  // wake at the n'th tick boundary from now.
+  return timersleep((r_time() / TICKCYCLES + n) * TICKCYCLES);
+}
+
+// sleep for the given number of nanoseconds.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  if(argaddr(0, &ns) < 0)
+    return -1;
+  return timersleep(r_time() + (ns + NSPERCYCLE - 1) / NSPERCYCLE);
+}
+
+// store the nanoseconds since boot at the user address.
+uint64
+sys_clock_gettime(void)
+{
+  uint64 addr, ns;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  ns = r_time() * NSPERCYCLE;
+  if(copyout(myproc()->pagetable, addr, (char*)&ns, sizeof(ns)) < 0)
+    return -1;
   return 0;
 }
 
@@ -83,6 +179,29 @@ sys_kill(void)
   return kill(pid);
 }
 
+// add to the caller's nice level; return the new level.
+uint64
+sys_nice(void)
+{
+  struct proc *p = myproc();
+  int inc;
+
+  if(argint(0, &inc) < 0)
+    return -1;
+  setnice(p->pid, p->nice + inc);
+  return p->nice;
+}
+
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  if(argint(0, &pid) < 0 || argint(1, &nice) < 0)
+    return -1;
+  return setnice(pid, nice);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -0,0 +1,12 @@
+// Counts and latencies of one system call, from sysstat().
+// Latency is in time-register cycles (see CLINT_FREQ).
+
+#define NSYSHIST 24
+
+struct sysstat {
+  uint64 count;            // calls that returned
+  uint64 cycles;           // total latency
+  uint hist[NSYSHIST];     // calls taking [2^i, 2^(i+1)) cycles;
+                           // hist[0] also counts 0, and the
+                           // last bucket everything longer
+};
@@ -0,0 +1,195 @@
+//
+// Timers.
+//
+// A sleeping process with a deadline, in time-register
+// cycles, sits on a min-heap ordered by deadline, so that
+// the clock interrupt wakes only the processes whose
+// deadlines have passed, and idle hart 0 can program its
+// timer for exactly the earliest one. timerarm() and
+// timerkick() program the CLINT; see clockintr() in trap.c.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  struct proc *heap[NPROC];  // heap[0] has the earliest wakeat
+  int n;
+} timers;
+
+void
+timersinit(void)
+{
+  initlock(&timers.lock, "timers");
+}
+
+static void
+heapset(int i, struct proc *p)
+{
+  timers.heap[i] = p;
+  p->tmidx = i;
+}
+
+// Move the process at heap index i up or down to its place.
+static void
+heapfix(int i)
+{
+  struct proc *p = timers.heap[i];
+  int c;
+
+  while(i > 0 && timers.heap[(i-1)/2]->wakeat > p->wakeat){
+    heapset(i, timers.heap[(i-1)/2]);
+    i = (i-1)/2;
+  }
+  while((c = 2*i + 1) < timers.n){
+    if(c+1 < timers.n && timers.heap[c+1]->wakeat < timers.heap[c]->wakeat)
+      c++;
+    if(timers.heap[c]->wakeat >= p->wakeat)
+      break;
+    heapset(i, timers.heap[c]);
+    i = c;
+  }
+  heapset(i, p);
+}
+
+static void
+heapremove(struct proc *p)
+{
+  int i = p->tmidx;
+
+  p->tmidx = -1;
+  if(--timers.n > i){
+    timers.heap[i] = timers.heap[timers.n];
+    heapfix(i);
+  }
+}
+
+// Sleep until the time register reaches deadline.
+// Returns 0, or -1 if the process was killed first.
+int
+timersleep(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  acquire(&timers.lock);
+  if(r_time() < deadline){
+    p->wakeat = deadline;
+    p->tmidx = timers.n++;
+    timers.heap[p->tmidx] = p;
+    heapfix(p->tmidx);
+    // hart 0 may have its timer set for a later deadline,
+    // or none at all; make it look again.
+    if(timers.heap[0] == p)
+      timerkick(0);
+    while(p->tmidx >= 0 && !p->killed)
+      sleep(&p->wakeat, &timers.lock);
+    if(p->tmidx >= 0)
+      heapremove(p);
+  }
+  release(&timers.lock);
+  return p->killed ? -1 : 0;
+}
+
+// Start watching for timerwake() calls on this process,
+// forgetting earlier ones; see timerwait().
+void
+timerwaitstart(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&timers.lock);
+  p->woken = 0;
+  release(&timers.lock);
+}
+
+// Sleep until another process calls timerwake() on this one,
+// if it hasn't since timerwaitstart(), or until the time
+// register reaches deadline, unless deadline is 0. Lets poll()
+// wait for whichever of its files is first ready.
+// Returns 0, or -1 if the process was killed first.
+int
+timerwait(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  acquire(&timers.lock);
+  if(deadline == 0 || r_time() < deadline){
+    if(deadline){
+      p->wakeat = deadline;
+      p->tmidx = timers.n++;
+      timers.heap[p->tmidx] = p;
+      heapfix(p->tmidx);
+      if(timers.heap[0] == p)
+        timerkick(0);
+    }
+    while(!p->woken && (deadline == 0 || p->tmidx >= 0) && !p->killed)
+      sleep(&p->wakeat, &timers.lock);
+    if(p->tmidx >= 0)
+      heapremove(p);
+  }
+  release(&timers.lock);
+  return p->killed ? -1 : 0;
+}
+
+// Wake p from timerwait(), or make its next one return at
+// once.
+void
+timerwake(struct proc *p)
+{
+  acquire(&timers.lock);
+  p->woken = 1;
+  wakeup(&p->wakeat);
+  release(&timers.lock);
+}
+
+// Wake the processes whose deadlines have passed.
+// Called by clockintr().
+void
+timerexpire(void)
+{
+  struct proc *p;
+
+  acquire(&timers.lock);
+  while(timers.n > 0 && timers.heap[0]->wakeat <= r_time()){
+    p = timers.heap[0];
+    heapremove(p);
+    wakeup(&p->wakeat);
+  }
+  release(&timers.lock);
+}
+
+// Program this hart's timer for its next deadline: the next
+// tick (or profiler sample) if it is running a process, the
+// earliest sleeper's deadline if it is hart 0 and idle, and
+// otherwise never.
+void
+timerarm(void)
+{
+  uint64 when = ~0ULL;
+  int id = cpuid();
+
+  acquire(&timers.lock);
+  if(!mycpu()->idle){
+    when = (r_time() / TICKCYCLES + 1) * TICKCYCLES;
+    if(profiling && r_time() + PROFCYCLES < when)
+      when = r_time() + PROFCYCLES;
+  }
+  if(id == 0 && timers.n > 0 && timers.heap[0]->wakeat < when)
+    when = timers.heap[0]->wakeat;
+  *(uint64*)CLINT_MTIMECMP(id) = when;
+  release(&timers.lock);
+}
+
+// Make hart id take a timer interrupt now, to get it out of
+// wfi and rearm its timer.
+void
+timerkick(int id)
+{
+  *(uint64*)CLINT_MTIMECMP(id) = 0;
+}
@@ -3,11 +3,15 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "mm.h"
+#include "vdso.h"
 #include "defs.h"
 
 struct spinlock tickslock;
 uint ticks;
+struct vdso *vdso;  // mapped read-only at VDSO in every process
 
 extern char trampoline[], uservec[], userret[];
 
@@ -15,11 +19,18 @@ extern char trampoline[], uservec[], userret[];
 void kernelvec();
 
 extern int devintr();
+extern uint64 kvmcycles;
 
 void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("trapinit: vdso");
+  memset(vdso, 0, PGSIZE);
+  vdso->timefreq = CLINT_FREQ;
+  vdso->ncpu = NCPU;
+  vdso->kvmcycles = kvmcycles;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -65,6 +76,18 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault: fill in a demand-paged page.
+    uint64 scause = r_scause();
+    uint64 va = r_stval();
+
+    intr_on();
+
+    if(vmafault(p, va, scause == 15, 0) != 0){
+      printf("usertrap(): page fault %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, va);
+      p->killed = 1;
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -76,13 +99,34 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // charge the tick, maybe giving up the CPU,
+  // if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    schedtick();
 
   usertrapret();
 }
 
+//
+// a system call on uservec's fast path in trampoline.S, which
+// has saved only the registers a C function may change, and
+// calls here with interrupts still off and the user's sepc,
+// sstatus and sscratch in place; see FASTSYSCALLS.
+// Returns the user satp for trampoline.S to switch back to.
+//
+uint64
+usertrapfast(void)
+{
+  struct proc *p = myproc();
+
+  w_stvec((uint64)kernelvec);
+  p->trapframe->epc = r_sepc() + 4;
+  syscall();
+  w_sepc(p->trapframe->epc);
+  w_stvec(TRAMPOLINE + (uservec - trampoline));
+  return MAKE_SATP(p->pagetable, p->mm->asid);
+}
+
 //
 // return to user space
 //
@@ -104,6 +148,7 @@ usertrapret(void)
   p->trapframe->kernel_satp = r_satp();         // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
+  p->trapframe->kernel_fast = (uint64)usertrapfast;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
 
   // set up the registers that trampoline.S's sret will use
@@ -119,13 +164,13 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable, p->mm->asid);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -149,23 +194,48 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // charge the tick, maybe giving up the CPU,
+  // if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    schedtick();
 
-  // the yield() may have caused some traps to occur,
+  // the schedtick() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
 }
 
-void
+// The clock is tickless when idle. A hart that is running a
+// process takes an interrupt on every tick, to charge the
+// process its time slice, but an idle hart programs its timer
+// only for the next deadline it must handle: hart 0 for the
+// earliest sleeper, the other harts for nothing at all; see
+// timer.c.
+// ticks is computed from the time register, so it is right
+// whichever hart updates it.
+// Returns 1 if this hart has passed a tick since it last
+// looked, 0 if the interrupt was only a kick.
+int
 clockintr()
 {
+  struct cpu *c = mycpu();
+  uint t;
+  int ticked;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  t = r_time() / TICKCYCLES;
+  if(t != ticks){
+    if(t / MLFQBOOST != ticks / MLFQBOOST)
+      schedboost();
+    ticks = t;
+    vdso->ticks = t;
+  }
   release(&tickslock);
+  timerexpire();
+  ticked = c->tick != t;
+  c->tick = t;
+  timerarm();
+  return ticked;
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -204,15 +274,16 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    profsample();
+
+    // a kick may be a TLB shootdown, and otherwise
+    // only wakes the hart; it isn't a tick.
+    mmsync();
+    return clockintr() ? 2 : 1;
   } else {
     return 0;
   }
@@ -9,6 +9,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "poll.h"
 
 // the UART control registers are memory-mapped
 // at address UART0. this macro returns the
@@ -44,6 +45,7 @@ struct spinlock uart_tx_lock;
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uar_tx_r % UART_TX_BUF_SIZE]
+struct pollq uart_tx_pq; // poll() calls waiting for space
 
 extern volatile int panicked; // from printf.c
 
@@ -108,6 +110,23 @@ uartputc(int c)
   }
 }
 
+// Return 1 if uartputc() won't sleep. If it would, and pe
+// isn't 0, put pe on the queue woken when there is space.
+int
+uartwritable(struct pollent *pe)
+{
+  int r;
+
+  acquire(&uart_tx_lock);
+  if(pe)
+    pe->ready = 0;
+  r = uart_tx_w != uart_tx_r + UART_TX_BUF_SIZE;
+  if(!r)
+    pollqadd(&uart_tx_pq, &uart_tx_lock, pe);
+  release(&uart_tx_lock);
+  return r;
+}
+
 // alternate version of uartputc() that doesn't 
 // use interrupts, for use by kernel printf() and
 // to echo characters. it spins waiting for the uart's
@@ -155,6 +174,7 @@ uartstart()
     
     // maybe uartputc() is waiting for space in the buffer.
     wakeup(&uart_tx_r);
+    pollwakeup(&uart_tx_pq);
     
     WriteReg(THR, c);
   }
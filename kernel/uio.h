@@ -0,0 +1,13 @@
+// A cursor over a run of user or kernel memory, for code that
+// moves a byte or a few at a time, such as the console. It
+// looks up each user page once, when the cursor reaches it,
+// rather than once per byte as copyin() and copyout() would.
+// See uioinit().
+struct uio {
+  pagetable_t pagetable;  // for a user address; 0 for a kernel one
+  int write;              // bytes will be stored, not fetched
+  uint64 addr;            // next address
+  uint64 resid;           // bytes left, from addr
+  char *p;                // kernel address of addr, if n > 0
+  uint64 n;               // bytes at p within the current page
+};
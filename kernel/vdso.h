@@ -0,0 +1,16 @@
+// Read-only pages mapped into every user address space, so
+// that a process can read these without a system call.
+
+// at VDSO, one page shared by every process.
+struct vdso {
+  uint64 ticks;         // what uptime() returns; set by clockintr()
+  uint64 timefreq;      // time-register cycles per second
+  int ncpu;             // harts
+  uint64 kvmcycles;     // cycles kvminit() took at boot
+};
+
+// at VDSOPROC, one page per address space.
+struct vdsoproc {
+  int pid;              // of the process that made the address
+                        // space; clone()d threads see their creator's
+};
@@ -3,18 +3,25 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
+#include "uio.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
+uint64 kvmcycles;  // time kvminit() took, for tlbbench; see vdso.h
 
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+static int mapsuperpages(pagetable_t, uint64, uint64, uint64, int);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -30,6 +37,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, so that each hart can program its own timer
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -43,8 +53,8 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // map kernel stacks
-  proc_mapstacks(kpgtbl);
+  // kernel stacks are mapped by allocproc() as processes
+  // are created.
   
   return kpgtbl;
 }
@@ -53,7 +63,10 @@ kvmmake(void)
 void
 kvminit(void)
 {
+  uint64 t0 = r_time();
+
   kernel_pagetable = kvmmake();
+  kvmcycles = r_time() - t0;
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -61,7 +74,7 @@ kvminit(void)
 void
 kvminithart()
 {
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
   sfence_vma();
 }
 
@@ -77,15 +90,34 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// Only the kernel page table has superpages. walk() returns 0
+// for a va in one, since the caller would take its PTE for a
+// page's; asked to allocate there, it panics.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Like walk(), but stop at the PTE for va in the given level
+// of page-table page, 1 to map a superpage or 0 for a page.
+// A superpage above that level is treated as walk() says.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X)){
+        // a superpage
+        if(alloc)
+          panic("walk: superpage");
+        return 0;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -94,7 +126,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(level, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -120,16 +152,52 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
-// add a mapping to the kernel page table.
+// add a mapping to the kernel page table, using superpages
+// where va and pa allow.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(mapsuperpages(kpgtbl, va, sz, pa, perm) != 0)
     panic("kvmmap");
 }
 
+// Like mappages(), but map each 2-megabyte-aligned stretch of
+// the range with a single superpage PTE, so that the kernel's
+// direct map of RAM needs few PTEs and TLB entries. The rest
+// of the range is mapped a page at a time.
+static int
+mapsuperpages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+  uint64 a, end, n;
+  pte_t *pte;
+
+  a = PGROUNDDOWN(va);
+  end = PGROUNDUP(va + size);
+  pa = PGROUNDDOWN(pa);
+  while(a < end){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && end - a >= SUPERPGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      n = SUPERPGSIZE;
+    } else {
+      // pages up to the next superpage boundary.
+      n = SUPERPGROUNDUP(a + 1) - a;
+      if(n > end - a)
+        n = end - a;
+      if(mappages(pagetable, a, n, pa, perm) != 0)
+        return -1;
+    }
+    a += n;
+    pa += n;
+  }
+  return 0;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
@@ -169,10 +237,11 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    // demand-paged regions may have pages that were never touched.
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -180,6 +249,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       kfree((void*)pa);
     }
     *pte = 0;
+    // the page table has an ASID, so switching to it doesn't
+    // flush the TLB; drop any cached translation now.
+    sfence_vma_va(a);
   }
 }
 
@@ -304,11 +376,18 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
+    if((flags & PTE_W) == 0){
+      // read-only pages, such as program text, can be shared.
+      if(mappages(new, i, PGSIZE, pa, flags) != 0)
+        goto err;
+      kdup((void*)pa);
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -337,17 +416,45 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Look up the physical address of user page va0 for copyin(),
+// copyout() or copyinstr(), asking vmafault() to fill in the
+// page if the current process hasn't touched it yet, or to
+// make a private copy if write is set and it's read-only.
+// If nowait is set, the caller holds a lock, and vmafault()
+// mustn't wait for another thread's hold on the mm lock.
+// Return 0 if the page can't be accessed.
+static uint64
+walkuser(pagetable_t pagetable, uint64 va0, int write, int nowait)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  if(va0 >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va0, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0)){
+    if(p == 0 || pagetable != p->pagetable)
+      return 0;
+    if(vmafault(p, va0, write, nowait) != 0)
+      return 0;
+    pte = walk(pagetable, va0, 0);
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  return PTE2PA(*pte);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
-int
-copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+static int
+copyout1(pagetable_t pagetable, uint64 dstva, char *src, uint64 len, int nowait)
 {
   uint64 n, va0, pa0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = walkuser(pagetable, va0, 1, nowait);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -362,17 +469,33 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
   return 0;
 }
 
+int
+copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+{
+  return copyout1(pagetable, dstva, src, len, 0);
+}
+
+// copyout() for a caller that holds an inode lock or a
+// spin-lock, and so has used vmaprefault() on dstva: fails
+// rather than wait for another thread to finish changing
+// the address space, which may need the same lock.
+int
+lockedcopyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+{
+  return copyout1(pagetable, dstva, src, len, 1);
+}
+
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
 // Return 0 on success, -1 on error.
-int
-copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+static int
+copyin1(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len, int nowait)
 {
   uint64 n, va0, pa0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = walkuser(pagetable, va0, 0, nowait);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -387,6 +510,19 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+int
+copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+{
+  return copyin1(pagetable, dst, srcva, len, 0);
+}
+
+// copyin() for a caller that holds a lock; see lockedcopyout().
+int
+lockedcopyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+{
+  return copyin1(pagetable, dst, srcva, len, 1);
+}
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -399,7 +535,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = walkuser(pagetable, va0, 0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -429,3 +565,72 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
     return -1;
   }
 }
+
+// Start u at the len bytes at addr, which is a user virtual
+// address in the current process if user is set, or else a
+// kernel address. write says whether uioputc() or uiogetc()
+// will be used. The caller must not hold a spin-lock unless
+// the user pages are known to be present; see vmaprefault().
+// Like lockedcopyout(), u doesn't wait for the mm lock.
+void
+uioinit(struct uio *u, int user, uint64 addr, uint64 len, int write)
+{
+  u->pagetable = user ? myproc()->pagetable : 0;
+  u->write = write;
+  u->addr = addr;
+  u->resid = len;
+  u->p = 0;
+  u->n = 0;
+}
+
+// Point u->p at u->addr, for up to the end of its page.
+// Returns 0, or -1 if there are no bytes left or the page
+// can't be accessed.
+static int
+uiomap(struct uio *u)
+{
+  uint64 va0, pa0;
+
+  if(u->resid == 0)
+    return -1;
+  if(u->pagetable == 0){
+    u->p = (char*)u->addr;
+    u->n = u->resid;
+    return 0;
+  }
+  va0 = PGROUNDDOWN(u->addr);
+  if((pa0 = walkuser(u->pagetable, va0, u->write, 1)) == 0)
+    return -1;
+  u->p = (char*)(pa0 + (u->addr - va0));
+  u->n = PGSIZE - (u->addr - va0);
+  if(u->n > u->resid)
+    u->n = u->resid;
+  return 0;
+}
+
+// Fetch the next byte from u.
+// Returns it, or -1 at the end or if the page is bad.
+int
+uiogetc(struct uio *u)
+{
+  if(u->n == 0 && uiomap(u) < 0)
+    return -1;
+  u->n--;
+  u->resid--;
+  u->addr++;
+  return *(uchar*)u->p++;
+}
+
+// Store c as the next byte of u.
+// Returns 0, or -1 at the end or if the page is bad.
+int
+uioputc(struct uio *u, int c)
+{
+  if(u->n == 0 && uiomap(u) < 0)
+    return -1;
+  u->n--;
+  u->resid--;
+  u->addr++;
+  *u->p++ = c;
+  return 0;
+}
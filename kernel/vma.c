@@ -0,0 +1,451 @@
+//
+// Demand-paged user memory.
+//
+// exec() describes each program segment with a struct vma
+// rather than reading it all in up front, and mmap() adds
+// regions of its own above MMAPBASE. The first touch of each
+// page faults, and vmafault() fills in just that page:
+// zeros for bss and anonymous memory, a private copy of the
+// file for writable MAP_PRIVATE data, and otherwise the page
+// cache's own page. So every process running a program shares
+// a single copy of its text, and MAP_SHARED mappings and
+// read() see each other's changes.
+//
+// Threads share the regions, in p->mm, so the functions here
+// run holding p->mm->lock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "mm.h"
+#include "file.h"
+#include "fcntl.h"
+#include "pagecache.h"
+#include "defs.h"
+
+// Return the region of p containing va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  // RISC-V has no write-only pages.
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Read in the page at va of file-backed region v.
+// Returns the physical page, with a reference for
+// the caller to map, or 0. Clears PTE_W in *perm
+// if the page must be mapped read-only for now.
+static char*
+vmafill(struct vma *v, uint64 va, int write, int *perm)
+{
+  struct cpage *pg;
+  uint64 pgoff = va - v->addr;
+  uint foff = v->off + pgoff;
+  uint n = v->filesz - pgoff;
+  char *mem = 0;
+
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  ilock(v->ip);
+  if(v->flags & MAP_SHARED){
+    // the page cache's page is the shared copy. map it
+    // read-only until written, so that vmawriteback()
+    // knows which pages are dirty.
+    if((pg = ipage(v->ip, foff / PGSIZE)) != 0){
+      mem = pg->data;
+      kdup(mem);
+      pcacherelse(pg);
+      if(!write)
+        *perm &= ~PTE_W;
+    }
+    iunlock(v->ip);
+    return mem;
+  }
+  if((v->prot & PROT_WRITE) == 0 && foff % PGSIZE == 0 && n == PGSIZE){
+    // a whole page of a read-only region, such as program
+    // text: map the page cache's copy.
+    if((pg = ipage(v->ip, foff / PGSIZE)) != 0){
+      mem = pg->data;
+      kdup(mem);
+      pcacherelse(pg);
+    }
+  }
+  if(mem == 0 && (mem = kalloc()) != 0){
+    memset(mem, 0, PGSIZE);
+    if(readi(v->ip, 0, (uint64)mem, foff, n) != n){
+      kfree(mem);
+      mem = 0;
+    }
+  }
+  iunlock(v->ip);
+  return mem;
+}
+
+// Handle a page fault at va in p, for a write if write != 0.
+// Returns 0 if the page is now mapped, or -1 if va isn't
+// in a region that allows the access or memory ran out.
+// Caller must hold p->mm->lock.
+static int
+vmafault1(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  // sbrk() may have shrunk the process below a region.
+  if(va < MMAPBASE && va >= p->mm->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((v = vmalookup(p, va)) == 0)
+    return -1;
+  if(v->prot == PROT_NONE)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if((*pte & PTE_U) == 0)
+      return -1;
+    if(write && (*pte & PTE_W) == 0){
+      // first write to a MAP_SHARED page.
+      if((v->flags & MAP_SHARED) == 0)
+        return -1;
+      *pte |= PTE_W;
+      sfence_vma_va(va);
+    }
+    return 0;
+  }
+
+  perm = vmaperm(v);
+  if(v->ip && va - v->addr < v->filesz){
+    if((mem = vmafill(v, va, write, &perm)) == 0)
+      return -1;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  sfence_vma_va(va);
+  return 0;
+}
+
+// Handle a page fault at va in p, as vmafault1() does.
+// May sleep reading the file, so the caller must not hold
+// a spin-lock; see vmaprefault(). If nowait is set, fails
+// rather than wait for another thread to finish changing
+// the address space: lockedcopyout()'s caller may hold an
+// inode lock that the other thread needs.
+int
+vmafault(struct proc *p, uint64 va, int write, int nowait)
+{
+  int r;
+
+  if(nowait){
+    if(!tryacquiresleep(&p->mm->lock))
+      return -1;
+  } else {
+    acquiresleep(&p->mm->lock);
+  }
+  r = vmafault1(p, va, write);
+  releasesleep(&p->mm->lock);
+  return r;
+}
+
+// Fault in the pages of [va, va+len) that p hasn't touched
+// yet, so that a copyin() or copyout() to them won't need to
+// read a file, or wait for p->mm->lock, while its caller
+// holds a spin-lock or an inode lock. Stops quietly at the
+// first page that can't be faulted in; the copy itself will
+// then fail as usual.
+void
+vmaprefault(struct proc *p, uint64 va, uint64 len, int write)
+{
+  struct vma *v;
+  uint64 a, start, end;
+  pte_t *pte;
+
+  acquiresleep(&p->mm->lock);
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    start = va > v->addr ? va : v->addr;
+    end = v->addr + v->len;
+    if(va + len < end)
+      end = va + len;
+    for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte && (*pte & PTE_V) && (!write || (*pte & PTE_W)))
+        continue;
+      if(vmafault1(p, a, write) < 0)
+        goto out;
+    }
+  }
+ out:
+  releasesleep(&p->mm->lock);
+}
+
+// Write the pages of MAP_SHARED region v in [start, end)
+// that pagetable has written back to the file, one
+// transaction per page so as not to overflow the log.
+// Only the part of each page inside the file is written;
+// a mapping never makes a file longer.
+static void
+vmawriteback(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 a;
+  uint off, n;
+  pte_t *pte;
+
+  if((v->flags & MAP_SHARED) == 0 || v->ip == 0)
+    return;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0)
+      continue;
+    off = v->off + (a - v->addr);
+    begin_op();
+    ilock(v->ip);
+    if(off < v->ip->size){
+      n = v->ip->size - off;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      writei(v->ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(v->ip);
+    end_op();
+  }
+}
+
+// Find a free range of len bytes at or above MMAPBASE
+// for mmap(). Returns 0 if there is none.
+// Caller must hold p->mm->lock.
+uint64
+vmaspace(struct proc *p, uint64 len)
+{
+  struct vma *v;
+  uint64 addr = MMAPBASE;
+
+ again:
+  if(addr + len < addr || addr + len > VDSOPROC)
+    return 0;
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len && addr < v->addr + v->len && v->addr < addr + len){
+      addr = v->addr + v->len;
+      goto again;
+    }
+  }
+  return addr;
+}
+
+// Add a region for mmap(). A MAP_SHARED anonymous region is
+// filled in at once, since pages that fork() shares with a
+// child must exist before the fork.
+// Returns 0 on success, -1 if p has no free vma slot or
+// memory runs out. Caller must hold p->mm->lock.
+int
+vmamap(struct proc *p, uint64 addr, uint64 len, int prot, int flags,
+       struct inode *ip, uint off)
+{
+  struct vma *v;
+  uint64 a;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len == 0)
+      break;
+  if(v == &p->mm->vma[NVMA])
+    return -1;
+
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->ip = ip ? idup(ip) : 0;
+  v->off = off;
+  v->filesz = 0;
+  if(ip){
+    ilock(ip);
+    if(off < ip->size)
+      v->filesz = ip->size - off < len ? ip->size - off : len;
+    iunlock(ip);
+  }
+
+  if(ip == 0 && (flags & MAP_SHARED) && prot != PROT_NONE){
+    for(a = addr; a < addr + len; a += PGSIZE){
+      if(vmafault1(p, a, prot & PROT_WRITE) < 0){
+        vmaunmap(p, addr, len);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Unmap [addr, addr+len), which must be page-aligned, from
+// the mmap() regions of p, writing back MAP_SHARED pages.
+// The range may cover the start, the end, or the whole of a
+// region; punching a hole in the middle needs a free vma slot.
+// Returns 0 on success, -1 on failure.
+// Caller must hold p->mm->lock.
+int
+vmaunmap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v, *nv;
+  uint64 start, end;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0 || v->addr < MMAPBASE)
+      continue;
+    start = addr > v->addr ? addr : v->addr;
+    end = addr + len < v->addr + v->len ? addr + len : v->addr + v->len;
+    if(start >= end)
+      continue;
+
+    if(start > v->addr && end < v->addr + v->len){
+      // split; the upper part gets a slot of its own.
+      for(nv = p->mm->vma; nv < &p->mm->vma[NVMA]; nv++)
+        if(nv->len == 0)
+          break;
+      if(nv == &p->mm->vma[NVMA])
+        return -1;
+      *nv = *v;
+      nv->addr = end;
+      nv->len = v->addr + v->len - end;
+      nv->off = v->off + (end - v->addr);
+      nv->filesz = v->filesz > end - v->addr ? v->filesz - (end - v->addr) : 0;
+      if(nv->ip)
+        idup(nv->ip);
+    }
+
+    vmawriteback(p->pagetable, v, start, end);
+    mmunmap(p->mm, start, (end - start) / PGSIZE);
+
+    if(start == v->addr && end == v->addr + v->len){
+      if(v->ip){
+        begin_op();
+        iput(v->ip);
+        end_op();
+      }
+      memset(v, 0, sizeof(*v));
+    } else if(start == v->addr){
+      v->off += end - v->addr;
+      v->filesz = v->filesz > end - v->addr ? v->filesz - (end - v->addr) : 0;
+      v->len -= end - v->addr;
+      v->addr = end;
+    } else {
+      v->len = start - v->addr;
+      if(v->filesz > v->len)
+        v->filesz = v->len;
+    }
+  }
+  return 0;
+}
+
+// Copy the regions of p to a fork()ed child np. The pages of
+// exec()'s regions come along with the rest of p->mm->sz in
+// uvmcopy(); here the mmap() regions' pages are shared with
+// the child if MAP_SHARED or read-only, and copied otherwise.
+// Returns 0 on success, -1 on failure.
+// Caller must hold p->mm->lock.
+int
+vmacopy(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+  uint64 a, pa;
+  pte_t *pte;
+  uint flags;
+  char *mem;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0 || v->addr < MMAPBASE)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte);
+      if((v->flags & MAP_SHARED) || (flags & PTE_W) == 0){
+        if(mappages(np->pagetable, a, PGSIZE, pa, flags) != 0)
+          goto err;
+        kdup((void*)pa);
+      } else {
+        if((mem = kalloc()) == 0)
+          goto err;
+        memmove(mem, (char*)pa, PGSIZE);
+        if(mappages(np->pagetable, a, PGSIZE, (uint64)mem, flags) != 0){
+          kfree(mem);
+          goto err;
+        }
+      }
+    }
+  }
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    np->mm->vma[v - p->mm->vma] = *v;
+    if(v->ip)
+      idup(v->ip);
+  }
+  return 0;
+
+ err:
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len && v->addr >= MMAPBASE)
+      uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+  return -1;
+}
+
+// Forget every region in vma[], writing back MAP_SHARED pages,
+// unmapping the regions from pagetable (if not 0), and
+// dropping the file references.
+// Must not be called inside a transaction.
+void
+vmafree(pagetable_t pagetable, struct vma *vma)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    if(pagetable){
+      vmawriteback(pagetable, v, v->addr, v->addr + v->len);
+      uvmunmap(pagetable, v->addr, v->len / PGSIZE, 1);
+    }
+    if(v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+    memset(v, 0, sizeof(*v));
+  }
+}
@@ -0,0 +1,31 @@
+// Write NUL bytes, which a terminal doesn't show, to the
+// console, whose driver takes them a byte at a time, and
+// report the rate.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define TOTAL (64*1024)
+#define CHUNK 4096
+
+char buf[CHUNK];
+
+int
+main(int argc, char *argv[])
+{
+  int total;
+  uint64 t0, t1;
+
+  clock_gettime(&t0);
+  for(total = 0; total < TOTAL; total += CHUNK){
+    if(write(1, buf, CHUNK) != CHUNK){
+      fprintf(2, "consbench: write failed\n");
+      exit(1);
+    }
+  }
+  clock_gettime(&t1);
+  printf("consbench: %d KB/s\n",
+         (int)((uint64)TOTAL / 1024 * 1000000000 / (t1 - t0 + 1)));
+  exit(0);
+}
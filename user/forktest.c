@@ -1,11 +1,15 @@
 // Test that fork fails gracefully.
 // Tiny executable so that the limit can be filling the proc table.
+// Then time fork, exit and wait with more and more other
+// children around, which shouldn't make them any slower.
 
+#include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-#define N  1000
+#define N  NPROC
+#define CHURN  200  // forks timed per round
 
 void
 print(const char *s)
@@ -13,6 +17,19 @@ print(const char *s)
   write(1, s, strlen(s));
 }
 
+void
+printnum(uint64 n)
+{
+  char buf[24];
+  int i = sizeof(buf);
+
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n != 0);
+  write(1, buf + i, sizeof(buf) - i);
+}
+
 void
 forktest(void)
 {
@@ -48,9 +65,71 @@ forktest(void)
   print("fork test OK\n");
 }
 
+// Time CHURN rounds of fork, exit and wait while nidle other
+// children sit blocked reading a pipe.
+void
+forktime(int nidle)
+{
+  int fds[2], n, pid;
+  uint64 t0, t1;
+  char c;
+
+  if(pipe(fds) < 0){
+    print("pipe failed\n");
+    exit(1);
+  }
+  for(n = 0; n < nidle; n++){
+    pid = fork();
+    if(pid < 0){
+      print("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+
+  clock_gettime(&t0);
+  for(n = 0; n < CHURN; n++){
+    pid = fork();
+    if(pid < 0){
+      print("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    if(wait(0) != pid){
+      print("wait got the wrong child\n");
+      exit(1);
+    }
+  }
+  clock_gettime(&t1);
+
+  // let the idle children go.
+  close(fds[1]);
+  for(n = 0; n < nidle; n++){
+    if(wait(0) < 0){
+      print("wait stopped early\n");
+      exit(1);
+    }
+  }
+
+  print("fork time: ");
+  printnum(nidle);
+  print(" other children: ");
+  printnum((t1 - t0) / CHURN / 1000);
+  print(" us per fork\n");
+}
+
 int
 main(void)
 {
   forktest();
+  forktime(0);
+  forktime(100);
+  forktime(1000);
   exit(0);
 }
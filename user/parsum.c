@@ -0,0 +1,81 @@
+// Sum a large array with 1, 2, 4 and then 7 threads made by
+// clone(), which all read the same memory, and report how long
+// each takes. With more than one hart (make CPUS=4 qemu) the
+// time should drop as threads are added, up to the number of
+// harts.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define N       (256*1024)
+#define ROUNDS  16
+#define MAXT    7
+#define STACKSZ 4096
+
+int *a;
+uint64 partial[MAXT];
+int nthread;
+
+void
+worker(void *arg)
+{
+  int id = (uint64)arg;
+  int lo = N / nthread * id;
+  int hi = id == nthread - 1 ? N : lo + N / nthread;
+  uint64 sum = 0;
+  int r, i;
+
+  for(r = 0; r < ROUNDS; r++)
+    for(i = lo; i < hi; i++)
+      sum += a[i];
+  partial[id] = sum;
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static int counts[] = { 1, 2, 4, MAXT };
+  int tids[MAXT];
+  char *stacks[MAXT];
+  uint64 t0, t1, sum;
+  int i, k, status;
+
+  a = malloc(N * sizeof(int));
+  for(i = 0; i < MAXT; i++)
+    stacks[i] = malloc(STACKSZ);
+  if(a == 0 || stacks[MAXT-1] == 0){
+    printf("parsum: out of memory\n");
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i] = i;
+
+  for(k = 0; k < sizeof(counts)/sizeof(counts[0]); k++){
+    nthread = counts[k];
+    clock_gettime(&t0);
+    for(i = 0; i < nthread; i++){
+      tids[i] = clone(worker, (void*)(uint64)i, stacks[i] + STACKSZ);
+      if(tids[i] < 0){
+        printf("parsum: clone failed\n");
+        exit(1);
+      }
+    }
+    sum = 0;
+    for(i = 0; i < nthread; i++){
+      if(join(tids[i], &status) != tids[i] || status != 0){
+        printf("parsum: join failed\n");
+        exit(1);
+      }
+      sum += partial[i];
+    }
+    clock_gettime(&t1);
+    if(sum != (uint64)ROUNDS * N * (N - 1) / 2){
+      printf("parsum: wrong sum\n");
+      exit(1);
+    }
+    printf("parsum: %d threads: %d ms\n", nthread, (int)((t1 - t0) / 1000000));
+  }
+  exit(0);
+}
@@ -0,0 +1,331 @@
+// Run a command under the sampling profiler and print the
+// functions in which it, and the kernel on its behalf, spent
+// the most time.
+//   prof cmd args
+// Only samples of the command and its descendants count, and
+// only user pcs in processes running cmd are symbolized.
+// Kernel pcs are looked up in /kernel.sym and user pcs in
+// /cmd.sym; the Makefile puts both on the file system.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+#define NPC   4096   // distinct pcs counted
+#define NTOP  20     // functions printed
+#define NBUF  64     // samples read per profctl()
+#define NTREE 256    // processes in the command's tree
+
+struct pccount {
+  uint64 key;        // pc << 1 | user; 0 if free
+  int n;
+};
+
+struct symtab {
+  int n;
+  uint64 *addr;      // sorted
+  char **name;
+  int *count;
+};
+
+struct pccount pcs[NPC];
+int total, nkernel, nuser, nother, dropped, ignored;
+int self;
+char *prog;          // basename of the command
+char progname[16];   // prog as exec() names the process
+
+// pids of prof and the command's process tree. A process
+// joins when a sample shows its parent is already in it.
+int tree[NTREE];
+int ntree;
+
+int
+intree(int pid)
+{
+  int i;
+
+  for(i = 0; i < ntree; i++)
+    if(tree[i] == pid)
+      return 1;
+  return 0;
+}
+
+void
+count(struct profsample *s)
+{
+  uint64 key = s->pc << 1 | (s->user != 0);
+  int i;
+
+  total++;
+  if(s->user && strcmp(s->name, progname) != 0){
+    // some other program, whose pcs /cmd.sym can't name.
+    nother++;
+    return;
+  }
+  if(s->user)
+    nuser++;
+  else
+    nkernel++;
+  for(i = (key >> 1) % NPC; ; i = (i + 1) % NPC){
+    if(pcs[i].key == key){
+      pcs[i].n++;
+      return;
+    }
+    if(pcs[i].key == 0){
+      pcs[i].key = key;
+      pcs[i].n = 1;
+      return;
+    }
+    if(i == ((key >> 1) + NPC - 1) % NPC)
+      break;
+  }
+  dropped++;
+}
+
+// Read the samples taken so far, and count the ones of the
+// command's process tree. Samples of other processes, and of
+// idle harts, are ignored. prof's own user time is not of
+// interest; its time in the kernel reading the samples is
+// left in, since it is part of the cost.
+void
+drain(void)
+{
+  struct profsample buf[NBUF];
+  int n, i, grew;
+
+  do {
+    if((n = profctl(PROF_READ, buf, NBUF)) < 0){
+      fprintf(2, "prof: profctl failed\n");
+      exit(1);
+    }
+    // the harts' rings are read one after another, so a child
+    // may show up before its parent does.
+    do {
+      grew = 0;
+      for(i = 0; i < n; i++)
+        if(ntree < NTREE && buf[i].pid != 0 && !intree(buf[i].pid)
+           && intree(buf[i].ppid)){
+          tree[ntree++] = buf[i].pid;
+          grew = 1;
+        }
+    } while(grew);
+    for(i = 0; i < n; i++){
+      if(!intree(buf[i].pid))
+        ignored++;
+      else if(!(buf[i].user && buf[i].pid == self))
+        count(&buf[i]);
+    }
+  } while(n == NBUF);
+}
+
+uint64
+hex(char **sp)
+{
+  char *s = *sp;
+  uint64 x = 0;
+
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      x = x*16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      x = x*16 + *s - 'a' + 10;
+    else
+      break;
+  }
+  *sp = s;
+  return x;
+}
+
+// Load a symbol table made by objdump -t and the Makefile's
+// sed: one "address name" line per symbol, in no order.
+// Section and file names (which contain a '.') are skipped.
+int
+loadsyms(char *path, struct symtab *t)
+{
+  struct stat st;
+  char *buf, *s, *e, *name;
+  uint64 a;
+  int fd, i, j, nl;
+
+  t->n = 0;
+  if((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  if(fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0){
+    close(fd);
+    return -1;
+  }
+  for(i = 0; i < st.size; i += j)
+    if((j = read(fd, buf + i, st.size - i)) <= 0)
+      break;
+  close(fd);
+  buf[i] = 0;
+
+  nl = 0;
+  for(s = buf; *s; s++)
+    if(*s == '\n')
+      nl++;
+  t->addr = malloc((nl + 1) * sizeof(uint64));
+  t->name = malloc((nl + 1) * sizeof(char*));
+  t->count = malloc((nl + 1) * sizeof(int));
+  if(t->addr == 0 || t->name == 0 || t->count == 0)
+    return -1;
+
+  for(s = buf; *s; s = e){
+    for(e = s; *e && *e != '\n'; e++)
+      ;
+    if(*e)
+      *e++ = 0;
+    a = hex(&s);
+    if(*s != ' ')
+      continue;
+    name = s + 1;
+    if(*name == 0 || strchr(name, '.'))
+      continue;
+    // insertion sort; the tables are a few thousand lines.
+    for(i = t->n; i > 0 && t->addr[i-1] > a; i--){
+      t->addr[i] = t->addr[i-1];
+      t->name[i] = t->name[i-1];
+    }
+    t->addr[i] = a;
+    t->name[i] = name;
+    t->n++;
+  }
+  memset(t->count, 0, t->n * sizeof(int));
+  return 0;
+}
+
+// Index of the symbol containing pc, or -1.
+int
+lookup(struct symtab *t, uint64 pc)
+{
+  int lo = 0, hi = t->n;
+
+  // find the last symbol whose address is <= pc.
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    if(t->addr[mid] <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
+
+void
+report(struct symtab *kt, struct symtab *ut)
+{
+  struct symtab *t;
+  int i, j, k, best, bestj, unknown;
+  struct symtab *bestt;
+
+  unknown = 0;
+  for(i = 0; i < NPC; i++){
+    if(pcs[i].key == 0)
+      continue;
+    t = (pcs[i].key & 1) ? ut : kt;
+    if((j = lookup(t, pcs[i].key >> 1)) < 0)
+      unknown += pcs[i].n;
+    else
+      t->count[j] += pcs[i].n;
+  }
+
+  printf("%d samples: %d kernel, %d user", total, nkernel, nuser);
+  if(nother)
+    printf(", %d in other programs", nother);
+  if(unknown + dropped)
+    printf(", %d unknown", unknown + dropped);
+  printf("\n");
+  if(ignored)
+    printf("%d samples of other processes ignored\n", ignored);
+  if(total == 0)
+    return;
+  for(k = 0; k < NTOP; k++){
+    best = 0;
+    bestt = 0;
+    bestj = 0;
+    for(t = kt; t; t = (t == kt ? ut : 0))
+      for(j = 0; j < t->n; j++)
+        if(t->count[j] > best){
+          best = t->count[j];
+          bestt = t;
+          bestj = j;
+        }
+    if(best == 0)
+      break;
+    printf("%d\t%d%%\t%s %s\n", best, best * 100 / total,
+           bestt == kt ? "k" : "u", bestt->name[bestj]);
+    bestt->count[bestj] = 0;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  static struct symtab kt, ut;
+  char path[64], *base, *s;
+  struct pollfd pfd;
+  int p[2], pid;
+
+  if(argc < 2){
+    fprintf(2, "usage: prof cmd args\n");
+    exit(1);
+  }
+  self = getpid();
+  for(prog = s = argv[1]; *s; s++)
+    if(*s == '/')
+      prog = s + 1;
+  memmove(progname, prog, strlen(prog) < sizeof(progname) ?
+          strlen(prog) : sizeof(progname) - 1);
+
+  // the command and its children hold p[1] open, so p[0]
+  // reports POLLHUP once they have all exited.
+  if(pipe(p) < 0){
+    fprintf(2, "prof: pipe failed\n");
+    exit(1);
+  }
+  if(profctl(PROF_START, 0, 0) < 0){
+    fprintf(2, "prof: profctl failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  tree[ntree++] = self;
+  tree[ntree++] = pid;
+  if(pid == 0){
+    close(p[0]);
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  close(p[1]);
+
+  // drain the rings well before they wrap.
+  pfd.fd = p[0];
+  pfd.events = POLLIN;
+  for(;;){
+    drain();
+    if(poll(&pfd, 1, 100) != 0)
+      break;
+  }
+  profctl(PROF_STOP, 0, 0);
+  drain();
+  wait(0);
+
+  if(loadsyms("/kernel.sym", &kt) < 0)
+    fprintf(2, "prof: no /kernel.sym\n");
+  base = prog;
+  if(strlen(base) + 6 > sizeof(path))
+    base = "";
+  strcpy(path, "/");
+  strcpy(path + 1, base);
+  strcpy(path + 1 + strlen(base), ".sym");
+  if(loadsyms(path, &ut) < 0)
+    fprintf(2, "prof: no %s\n", path);
+  report(&kt, &ut);
+  exit(0);
+}
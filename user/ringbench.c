@@ -0,0 +1,84 @@
+// Read a file 64 bytes at a time, first with one read() per
+// record and then with IORING_SIZE records queued for each
+// io_enter(), and report how long each takes. The file stays
+// in the page cache, so the difference is the cost of a
+// system call per record.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+#include "kernel/ioring.h"
+
+#define FILESZ (64*1024)
+#define REC    64
+#define ROUNDS 16
+
+char buf[FILESZ];
+struct io_ring ring;
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, r, off;
+  uint64 t0, t1, t2;
+  struct io_sqe *sqe;
+  struct io_cqe *cqe;
+
+  fd = open("ringbench.tmp", O_CREATE | O_RDWR);
+  memset(buf, 'x', sizeof(buf));
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("ringbench: cannot create ringbench.tmp\n");
+    exit(1);
+  }
+  close(fd);
+
+  clock_gettime(&t0);
+  for(r = 0; r < ROUNDS; r++){
+    fd = open("ringbench.tmp", O_RDONLY);
+    for(off = 0; off < FILESZ; off += REC){
+      if(read(fd, buf + off, REC) != REC){
+        printf("ringbench: read failed\n");
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  clock_gettime(&t1);
+
+  for(r = 0; r < ROUNDS; r++){
+    fd = open("ringbench.tmp", O_RDONLY);
+    for(off = 0; off < FILESZ; ){
+      for(n = 0; n < IORING_SIZE && off < FILESZ; n++, off += REC){
+        sqe = &ring.sq[ring.sqtail % IORING_SIZE];
+        sqe->op = IO_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64)(buf + off);
+        sqe->len = REC;
+        sqe->off = -1;
+        sqe->data = off;
+        ring.sqtail++;
+      }
+      if(io_enter(&ring, n) != n){
+        printf("ringbench: io_enter failed\n");
+        exit(1);
+      }
+      // reap without a system call.
+      for(i = 0; i < n; i++){
+        cqe = &ring.cq[ring.cqhead++ % IORING_SIZE];
+        if(cqe->res != REC){
+          printf("ringbench: read at %d failed\n", (int)cqe->data);
+          exit(1);
+        }
+      }
+    }
+    close(fd);
+  }
+  clock_gettime(&t2);
+  unlink("ringbench.tmp");
+
+  n = ROUNDS * (FILESZ / REC);
+  printf("ringbench: %d reads: read %d us, io_enter %d us\n", n,
+         (int)((t1 - t0) / 1000), (int)((t2 - t1) / 1000));
+  exit(0);
+}
@@ -0,0 +1,70 @@
+// Measure how long an interactive process waits for the CPU
+// while CPU-bound processes keep every hart busy. The
+// interactive loop sleeps for one tick at a time, as a shell
+// waiting for keystrokes would, and records how many ticks
+// late it wakes up. With the multi-level feedback queue the
+// spinners sink to the lowest priority level and the sleeper
+// preempts them on the next tick.
+//
+// usage: schedbench [nspin [nice]]
+// runs nspin spinners (default 4) at the given nice level
+// (default 0).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NSPIN  16
+#define ROUNDS 100
+
+int
+main(int argc, char *argv[])
+{
+  int pids[NSPIN];
+  int i, nspin, lvl, t0, late, total, worst;
+  volatile int x = 0;
+
+  nspin = argc > 1 ? atoi(argv[1]) : 4;
+  lvl = argc > 2 ? atoi(argv[2]) : 0;
+  if(nspin < 0 || nspin > NSPIN){
+    printf("schedbench: at most %d spinners\n", NSPIN);
+    exit(1);
+  }
+
+  for(i = 0; i < nspin; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("schedbench: fork failed\n");
+      nspin = i;
+      break;
+    }
+    if(pids[i] == 0){
+      nice(lvl);
+      for(;;)
+        x++;
+    }
+  }
+
+  // let the spinners use up their time slices.
+  sleep(10);
+
+  total = worst = 0;
+  for(i = 0; i < ROUNDS; i++){
+    t0 = uptime();
+    sleep(1);
+    late = uptime() - t0 - 1;
+    total += late;
+    if(late > worst)
+      worst = late;
+  }
+
+  for(i = 0; i < nspin; i++)
+    kill(pids[i]);
+  for(i = 0; i < nspin; i++)
+    wait(0);
+
+  printf("schedbench: %d spinners at nice %d: %d sleeps, "
+         "%d ticks late in total, worst %d\n",
+         nspin, lvl, ROUNDS, total, worst);
+  exit(0);
+}
@@ -0,0 +1,124 @@
+// Print how many times each system call has been made, how
+// long calls took on average, and a log2 histogram of their
+// latencies, in units of the time register's cycle.
+//   sysstat            print the statistics since boot or reset
+//   sysstat -r         reset them
+//   sysstat cmd args   reset them, run cmd, and print them
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/syscall.h"
+#include "kernel/sysstat.h"
+#include "user/user.h"
+
+#define MAXSYS 64
+
+char *names[MAXSYS] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_symlink] "symlink",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_nice]    "nice",
+[SYS_setpriority] "setpriority",
+[SYS_nanosleep] "nanosleep",
+[SYS_clock_gettime] "clock_gettime",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futex_wait] "futex_wait",
+[SYS_futex_wake] "futex_wake",
+[SYS_spawn]   "spawn",
+[SYS_splice]  "splice",
+[SYS_tee]     "tee",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_io_enter] "io_enter",
+[SYS_poll]    "poll",
+[SYS_fsync]   "fsync",
+[SYS_fdatasync] "fdatasync",
+[SYS_logmode] "logmode",
+[SYS_sysstat] "sysstat",
+[SYS_profctl] "profctl",
+};
+
+struct sysstat st[MAXSYS];
+
+void
+print(void)
+{
+  int n, num, b;
+
+  if((n = sysstat(st, MAXSYS)) < 0){
+    fprintf(2, "sysstat: sysstat failed\n");
+    exit(1);
+  }
+  if(n > MAXSYS)
+    n = MAXSYS;
+  printf("syscall        calls avg-ns histogram (i:calls taking 2^i to 2^(i+1) x %dns)\n",
+         (int)NSPERCYCLE);
+  for(num = 0; num < n; num++){
+    if(st[num].count == 0)
+      continue;
+    printf("%s", names[num] ? names[num] : "?");
+    for(b = strlen(names[num] ? names[num] : "?"); b < 14; b++)
+      printf(" ");
+    printf(" %d %d ", (int)st[num].count,
+           (int)(st[num].cycles * NSPERCYCLE / st[num].count));
+    for(b = 0; b < NSYSHIST; b++)
+      if(st[num].hist[b])
+        printf(" %d:%d", b, st[num].hist[b]);
+    printf("\n");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pid, xstatus;
+
+  if(argc < 2){
+    print();
+    exit(0);
+  }
+  sysstat(0, 0);
+  if(strcmp(argv[1], "-r") == 0)
+    exit(0);
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "sysstat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "sysstat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(&xstatus);
+  print();
+  exit(0);
+}
@@ -0,0 +1,63 @@
+// Time read()s of a file that is already in the page cache.
+// Each read copies out of page-cache pages spread across
+// physical memory, through the kernel's direct map of RAM,
+// so the run time reflects how many TLB misses the kernel
+// takes on that map (superpages make it far fewer). Also
+// print how long the kernel took at boot to build that map.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
+
+#define FILESZ (1024*1024)
+#define CHUNK  4096
+#define ROUNDS 64
+
+char buf[16*CHUNK];
+
+int
+main(int argc, char *argv[])
+{
+  volatile struct vdso *v = (struct vdso*)VDSO;
+  int fd, i, n, start, elapsed;
+
+  printf("tlbbench: kvminit took %d cycles (%d us)\n", (int)v->kvmcycles,
+         (int)(v->kvmcycles * 1000000 / v->timefreq));
+
+  fd = open("tlbbench.tmp", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("tlbbench: cannot create tlbbench.tmp\n");
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(n = 0; n < FILESZ; n += sizeof(buf)){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("tlbbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  start = uptime();
+  for(i = 0; i < ROUNDS; i++){
+    fd = open("tlbbench.tmp", O_RDONLY);
+    for(n = 0; n < FILESZ; n += CHUNK){
+      if(read(fd, buf + (n/CHUNK % 16)*CHUNK, CHUNK) != CHUNK){
+        printf("tlbbench: read failed\n");
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  elapsed = uptime() - start;
+
+  unlink("tlbbench.tmp");
+  printf("tlbbench: read %d MB from the page cache in %d ticks\n",
+         ROUNDS * (FILESZ / (1024*1024)), elapsed);
+  exit(0);
+}
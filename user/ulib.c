@@ -2,6 +2,10 @@
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
 #include "user/user.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -134,3 +138,98 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// A mutex costs one atomic instruction to take and one to
+// release when there is no contention; only a thread that
+// finds it locked, or a release that may have waiters to
+// wake, enters the kernel, with futex_wait() and futex_wake().
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // mark it waited for, so the holder will wake someone.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    m->state = 0;
+    __sync_synchronize();
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+  c->waiters = 0;
+}
+
+// Release m, wait for a signal, and take m again.
+// Caller must hold m.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  c->waiters++;
+  mutex_unlock(m);
+  // returns at once if a signal came after seq was read.
+  futex_wait(&c->seq, seq);
+  // others may be waiting for m too, so take it as waited for.
+  while(__sync_lock_test_and_set(&m->state, 2) != 0)
+    futex_wait(&m->state, 2);
+  c->waiters--;
+}
+
+// Wake one thread waiting on c. The caller should hold the
+// mutex that waiters use, or a signal may find no waiters
+// and skip the wakeup.
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->waiters > 0)
+    futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->waiters > 0)
+    futex_wake(&c->seq, c->waiters);
+}
+
+// uptime() and getpid() without a system call, from the pages
+// the kernel maps read-only at VDSO and VDSOPROC. A thread
+// made by clone() gets its creator's pid.
+int
+vdso_uptime(void)
+{
+  return ((volatile struct vdso*)VDSO)->ticks;
+}
+
+int
+vdso_getpid(void)
+{
+  return ((struct vdsoproc*)VDSOPROC)->pid;
+}
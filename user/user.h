@@ -1,4 +1,9 @@
 struct stat;
+struct iovec;
+struct io_ring;
+struct pollfd;
+struct sysstat;
+struct profsample;
 struct rtcdate;
 
 // system calls
@@ -26,6 +31,30 @@ int uptime(void);
 int uptime(void);
 // lab9 q2
 int symlink(const char*, const char*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int nice(int);
+int setpriority(int, int);
+int nanosleep(uint64);
+int clock_gettime(uint64*);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int spawn(char*, char**, int*);
+int splice(int, int, int);
+int tee(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int io_enter(struct io_ring*, int);
+int poll(struct pollfd*, int, int);
+int fsync(int);
+int fdatasync(int);
+int logmode(int);
+int sysstat(struct sysstat*, int);
+int profctl(int, struct profsample*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -43,3 +72,23 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// ulib.c: locks for threads and for processes sharing memory.
+struct mutex {
+  int state;   // 0 unlocked, 1 locked, 2 locked and maybe waited for
+};
+struct cond {
+  int seq;     // bumped by each signal
+  int waiters; // threads in cond_wait(); changed holding the mutex
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+// ulib.c: reads of the vdso pages.
+int vdso_uptime(void);
+int vdso_getpid(void);
@@ -7,6 +7,9 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/ioring.h"
+#include "kernel/sysstat.h"
+#include "kernel/prof.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -779,6 +782,522 @@ pipe1(char *s)
   }
 }
 
+// how fast can a pipe move data? prints KB per second.
+void
+pipebench(char *s)
+{
+  enum { TOTAL=8*1024*1024, CHUNK=8192 };
+  int fds[2], pid, xstatus, n, total;
+  uint64 t0, t1;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  clock_gettime(&t0);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    memset(buf, 'p', CHUNK);
+    for(total = 0; total < TOTAL; total += CHUNK){
+      if(write(fds[1], buf, CHUNK) != CHUNK){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    total += n;
+  clock_gettime(&t1);
+  close(fds[0]);
+  wait(&xstatus);
+  if(total != TOTAL || xstatus != 0){
+    printf("%s: read %d bytes of %d\n", s, total, TOTAL);
+    exit(1);
+  }
+  printf("%d KB/s ", (int)((uint64)TOTAL / 1024 * 1000000000 / (t1 - t0 + 1)));
+}
+
+// writev() records of several sizes, one bigger than a log
+// transaction's worth, read them back with readv() and
+// pread(), and check that pwrite() leaves the offset alone.
+void
+iovtest(char *s)
+{
+  enum { BIG=(MAXOPBLOCKS+1)*BSIZE };
+  char hdr[8], tail[3], c;
+  struct iovec iov[3];
+  int fd, fds[2], i;
+
+  unlink("iovf");
+  fd = open("iovf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create iovf failed\n", s);
+    exit(1);
+  }
+  memmove(hdr, "header!", 8);
+  memmove(tail, "end", 3);
+  for(i = 0; i < BIG; i++)
+    buf[i] = 'a' + i % 26;
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = buf;
+  iov[1].iov_len = BIG;
+  iov[2].iov_base = tail;
+  iov[2].iov_len = sizeof(tail);
+  if(writev(fd, iov, 3) != sizeof(hdr) + BIG + sizeof(tail)){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+
+  if(pwrite(fd, "Z", 1, sizeof(hdr) + 1) != 1 || write(fd, "!", 1) != 1){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, &c, 1, sizeof(hdr) + BIG + sizeof(tail)) != 1 || c != '!'){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, &c, 1, sizeof(hdr) + 1) != 1 || c != 'Z' ||
+     pread(fd, &c, 1, 100000) != 0){
+    printf("%s: pread failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iovf", O_RDONLY);
+  memset(hdr, 0, sizeof(hdr));
+  memset(buf, 0, BIG);
+  memset(tail, 0, sizeof(tail));
+  if(readv(fd, iov, 3) != sizeof(hdr) + BIG + sizeof(tail)){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(strcmp(hdr, "header!") != 0 || memcmp(tail, "end", 3) != 0){
+    printf("%s: readv got the wrong records\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BIG; i++){
+    if(buf[i] != (i == 1 ? 'Z' : 'a' + i % 26)){
+      printf("%s: readv got the wrong data\n", s);
+      exit(1);
+    }
+  }
+  if(read(fd, &c, 1) != 1 || c != '!' || readv(fd, iov, 3) != 0){
+    printf("%s: readv left the wrong offset\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iovf");
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(pread(fds[0], &c, 1, 0) != -1 || pwrite(fds[1], "x", 1, 0) != -1){
+    printf("%s: pread or pwrite on a pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+struct io_ring ioring;
+
+static void
+ioqueue(int op, int fd, void *addr, int len, int off)
+{
+  struct io_sqe *sqe = &ioring.sq[ioring.sqtail % IORING_SIZE];
+
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->addr = (uint64)addr;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->data = ioring.sqtail;
+  ioring.sqtail++;
+}
+
+// reap the next completion, checking it is for request i.
+static int
+ioreap(char *s, uint i)
+{
+  struct io_cqe *cqe;
+
+  if(ioring.cqhead == ioring.cqtail){
+    printf("%s: no completion\n", s);
+    exit(1);
+  }
+  cqe = &ioring.cq[ioring.cqhead++ % IORING_SIZE];
+  if(cqe->data != i){
+    printf("%s: completion out of order\n", s);
+    exit(1);
+  }
+  return cqe->res;
+}
+
+// open, write, read and close a file through io_enter().
+void
+ioringtest(char *s)
+{
+  char rbuf[8];
+  int fd, i;
+
+  unlink("ioringf");
+  ioqueue(IO_OPEN, 0, "ioringf", O_CREATE|O_RDWR, 0);
+  if(io_enter(&ioring, 1) != 1 || (fd = ioreap(s, 0)) < 0){
+    printf("%s: IO_OPEN failed\n", s);
+    exit(1);
+  }
+  ioqueue(IO_WRITE, fd, "hello ", 6, -1);
+  ioqueue(IO_WRITE, fd, "world", 5, -1);
+  ioqueue(IO_FSYNC, fd, 0, 0, 0);
+  ioqueue(IO_READ, fd, rbuf, 5, 6);
+  ioqueue(IO_CLOSE, fd, 0, 0, 0);
+  ioqueue(IO_READ, fd, rbuf, 5, 0);
+  if(io_enter(&ioring, 100) != 6 || ioring.sqhead != 7){
+    printf("%s: io_enter took the wrong number\n", s);
+    exit(1);
+  }
+  if(ioreap(s, 1) != 6 || ioreap(s, 2) != 5 || ioreap(s, 3) != 0 ||
+     ioreap(s, 4) != 5 || ioreap(s, 5) != 0 || ioreap(s, 6) != -1){
+    printf("%s: wrong results\n", s);
+    exit(1);
+  }
+  if(memcmp(rbuf, "world", 5) != 0){
+    printf("%s: read the wrong data\n", s);
+    exit(1);
+  }
+  if(ioring.cqhead != ioring.cqtail){
+    printf("%s: too many completions\n", s);
+    exit(1);
+  }
+
+  // io_enter() stops when the completion queue is full.
+  for(i = 0; i < IORING_SIZE; i++)
+    ioqueue(IO_NOP, 0, 0, 0, 0);
+  if(io_enter(&ioring, IORING_SIZE) != IORING_SIZE){
+    printf("%s: IO_NOP failed\n", s);
+    exit(1);
+  }
+  ioqueue(IO_NOP, 0, 0, 0, 0);
+  if(io_enter(&ioring, 1) != 0){
+    printf("%s: io_enter overran the completion queue\n", s);
+    exit(1);
+  }
+  ioring.cqhead = ioring.cqtail;
+  if(io_enter(&ioring, 1) != 1){
+    printf("%s: io_enter after reaping failed\n", s);
+    exit(1);
+  }
+  unlink("ioringf");
+}
+
+// poll() two pipes, one of which a child writes to later.
+void
+polltest(char *s)
+{
+  struct pollfd pfd[4];
+  int a[2], b[2], pid, xstatus;
+  char c;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = -1;
+  pfd[3].fd = NOFILE - 1;
+  pfd[3].events = POLLIN;
+  if(poll(pfd, 3, 0) != 0 || poll(pfd, 2, 50) != 0){
+    printf("%s: poll of empty pipes\n", s);
+    exit(1);
+  }
+  if(poll(pfd, 4, 0) != 1 || pfd[3].revents != POLLNVAL){
+    printf("%s: poll of a bad fd\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents != 0 || pfd[1].revents != POLLIN){
+    printf("%s: poll missed the write\n", s);
+    exit(1);
+  }
+  if(read(b[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: read after poll\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+
+  pfd[0].fd = a[1];
+  pfd[0].events = POLLOUT;
+  if(poll(pfd, 1, 0) != 1 || pfd[0].revents != POLLOUT){
+    printf("%s: pipe not writable\n", s);
+    exit(1);
+  }
+  close(b[1]);
+  if(poll(pfd + 1, 1, 0) != 1 || pfd[1].revents != POLLHUP){
+    printf("%s: no POLLHUP\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+}
+
+// small writes in batch log mode, with fsync() barriers.
+void
+fsynctest(char *s)
+{
+  enum { N=200 };
+  int fd, i, old, r1, r2;
+  char c;
+
+  unlink("fsyncf");
+  old = logmode(1);
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    logmode(old);
+    printf("%s: create fsyncf failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    c = 'a' + i % 26;
+    if(write(fd, &c, 1) != 1)
+      break;
+    if(i % 50 == 49 && fsync(fd) != 0)
+      break;
+  }
+  r1 = fdatasync(fd);
+  r2 = logmode(old);
+  if(i != N || r1 != 0 || r2 != 1){
+    printf("%s: write, fsync or logmode failed\n", s);
+    exit(1);
+  }
+  if(fsync(-1) != -1 || fsync(NOFILE - 1) != -1){
+    printf("%s: fsync of a bad fd\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("fsyncf", O_RDONLY);
+  for(i = 0; i < N; i++){
+    if(read(fd, &c, 1) != 1 || c != 'a' + i % 26){
+      printf("%s: wrong data\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("fsyncf");
+}
+
+// the vdso pages agree with getpid() and uptime(), which take
+// the fast system call path, and can't be written.
+void
+vdsotest(char *s)
+{
+  int i, pid, xstatus, t0, t1;
+
+  if(vdso_getpid() != getpid()){
+    printf("%s: vdso pid %d, getpid() %d\n", s, vdso_getpid(), getpid());
+    exit(1);
+  }
+  for(i = 0; i < 1000; i++){
+    t0 = uptime();
+    t1 = vdso_uptime();
+    if(t1 < t0 || t1 > uptime()){
+      printf("%s: vdso ticks %d, uptime() %d\n", s, t1, t0);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(vdso_getpid() != getpid()){
+      printf("%s: vdso pid wrong in child\n", s);
+      exit(1);
+    }
+    *(int*)VDSO = 0;
+    printf("%s: wrote the vdso page\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    exit(1);
+}
+
+// sysstat() counts calls, with a histogram entry for each.
+void
+sysstattest(char *s)
+{
+  static struct sysstat st[SYS_sysstat+1];
+  int i, n, sum;
+
+  if(sysstat(0, 0) <= SYS_sysstat){
+    printf("%s: sysstat reset failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++)
+    getpid();
+  n = sysstat(st, SYS_sysstat+1);
+  if(n <= SYS_sysstat || st[SYS_getpid].count < 10 || st[SYS_sysstat].count < 1){
+    printf("%s: sysstat missed calls\n", s);
+    exit(1);
+  }
+  sum = 0;
+  for(i = 0; i < NSYSHIST; i++)
+    sum += st[SYS_getpid].hist[i];
+  if(sum != st[SYS_getpid].count){
+    printf("%s: histogram doesn't add up\n", s);
+    exit(1);
+  }
+}
+
+// spin for a few ticks under the profiler, and expect it to
+// have caught this process in user space.
+void
+proftest(char *s)
+{
+  enum { N=64 };
+  static struct profsample ps[N];
+  int i, n, mine, pid, t;
+
+  if(profctl(PROF_START, 0, 0) < 0){
+    printf("%s: profctl start failed\n", s);
+    exit(1);
+  }
+  pid = getpid();
+  mine = 0;
+  t = uptime();
+  while(uptime() < t + 3){
+    if((n = profctl(PROF_READ, ps, N)) < 0){
+      printf("%s: profctl read failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < n; i++)
+      if(ps[i].pid == pid && ps[i].user &&
+         strcmp(ps[i].name, "usertests") == 0)
+        mine++;
+  }
+  profctl(PROF_STOP, 0, 0);
+  if(mine == 0){
+    printf("%s: no samples\n", s);
+    exit(1);
+  }
+  if(profctl(99, 0, 0) != -1){
+    printf("%s: bad command accepted\n", s);
+    exit(1);
+  }
+}
+
+// splice() a file into a pipe, tee() that into a second
+// pipe, splice() the first to a file and the second through a
+// third pipe, and check both copies.
+void
+splicetest(char *s)
+{
+  enum { SZ=2*PGSIZE+100 };
+  int fd, fd2, a[2], b[2], c[2], i, n, tot;
+
+  unlink("splicef");
+  unlink("splicef2");
+  fd = open("splicef", O_CREATE|O_RDWR);
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 251;
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: create splicef failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("splicef", O_RDONLY);
+  fd2 = open("splicef2", O_CREATE|O_RDWR);
+  if(fd < 0 || fd2 < 0 || pipe(a) < 0 || pipe(b) < 0 || pipe(c) < 0){
+    printf("%s: open or pipe failed\n", s);
+    exit(1);
+  }
+
+  if((n = splice(fd, a[1], SZ + 1000)) != SZ){
+    printf("%s: splice from file moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, a[1], 10) != 0){
+    printf("%s: splice past end of file\n", s);
+    exit(1);
+  }
+  if((n = tee(a[0], b[1], SZ)) != SZ){
+    printf("%s: tee copied %d\n", s, n);
+    exit(1);
+  }
+  if((n = splice(a[0], fd2, SZ)) != SZ){
+    printf("%s: splice to file moved %d\n", s, n);
+    exit(1);
+  }
+  if((n = splice(b[0], c[1], SZ)) != SZ){
+    printf("%s: splice between pipes moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, fd2, 1) != -1 || splice(a[1], b[1], 1) != -1){
+    printf("%s: splice with bad fds\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fd2);
+  close(a[1]);
+  close(b[1]);
+  close(c[1]);
+
+  memset(buf, 0, SZ);
+  for(tot = 0; (n = read(c[0], buf + tot, SZ - tot)) > 0; tot += n)
+    ;
+  for(i = 0; i < SZ; i++){
+    if(tot != SZ || (buf[i] & 0xff) != i % 251){
+      printf("%s: wrong data through pipes\n", s);
+      exit(1);
+    }
+  }
+  fd2 = open("splicef2", O_RDONLY);
+  memset(buf, 0, SZ);
+  if(read(fd2, buf, SZ + 1) != SZ){
+    printf("%s: splicef2 has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if((buf[i] & 0xff) != i % 251){
+      printf("%s: wrong data in splicef2\n", s);
+      exit(1);
+    }
+  }
+  close(fd2);
+  close(a[0]);
+  close(b[0]);
+  close(c[0]);
+  unlink("splicef");
+  unlink("splicef2");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -2016,7 +2535,7 @@ iref(char *s)
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = NPROC };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -2033,7 +2552,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2624,6 +3143,288 @@ execout(char *s)
   exit(0);
 }
 
+// a clone()d thread shares memory and file descriptors with
+// its creator, and is reaped by join(), not wait().
+volatile int cloneshared, clonefd;
+
+void
+clonechild(void *arg)
+{
+  cloneshared = (uint64)arg;
+  clonefd = dup(0);
+  exit(7);
+}
+
+void
+clonetest(char *s)
+{
+  char *stack;
+  int tid, status;
+
+  stack = sbrk(PGSIZE);
+  cloneshared = 0;
+  clonefd = -1;
+  tid = clone(clonechild, (void*)1234, stack + PGSIZE);
+  if(tid < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: wait() returned a thread\n", s);
+    exit(1);
+  }
+  if(join(tid, &status) != tid || status != 7){
+    printf("%s: join failed\n", s);
+    exit(1);
+  }
+  if(cloneshared != 1234){
+    printf("%s: thread's write not seen\n", s);
+    exit(1);
+  }
+  if(clonefd < 0 || close(clonefd) != 0){
+    printf("%s: thread's fd not shared\n", s);
+    exit(1);
+  }
+  if(join(tid, 0) != -1){
+    printf("%s: joined a thread twice\n", s);
+    exit(1);
+  }
+  sbrk(-PGSIZE);
+}
+
+// threads contend for a mutex, and signal a condition
+// variable when done.
+struct mutex futexmu;
+struct cond futexcv;
+int futexcount, futexdone;
+
+void
+futexchild(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 10000; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+  mutex_lock(&futexmu);
+  futexdone++;
+  cond_signal(&futexcv);
+  mutex_unlock(&futexmu);
+  exit(0);
+}
+
+void
+futextest(char *s)
+{
+  char *stacks;
+  int tids[2], i;
+
+  mutex_init(&futexmu);
+  cond_init(&futexcv);
+  futexcount = futexdone = 0;
+  stacks = sbrk(2*PGSIZE);
+  for(i = 0; i < 2; i++){
+    tids[i] = clone(futexchild, 0, stacks + (i+1)*PGSIZE);
+    if(tids[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  mutex_lock(&futexmu);
+  while(futexdone < 2)
+    cond_wait(&futexcv, &futexmu);
+  mutex_unlock(&futexmu);
+  for(i = 0; i < 2; i++)
+    join(tids[i], 0);
+  if(futexcount != 20000){
+    printf("%s: count %d, not 20000\n", s, futexcount);
+    exit(1);
+  }
+  if(futex_wait(&futexcount, 0) != -1){
+    printf("%s: futex_wait slept on the wrong value\n", s);
+    exit(1);
+  }
+  sbrk(-2*PGSIZE);
+}
+
+// spawn() starts a program with the file descriptors it is
+// given, and only those, as a child that wait() reaps.
+void
+spawntest(char *s)
+{
+  int fds[2], cfds[3], pid, xstatus, n;
+  char *argv[] = { "echo", "spawned", 0 };
+  char buf[32];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  cfds[0] = -1;
+  cfds[1] = fds[1];
+  cfds[2] = 2;
+  if((pid = spawn("echo", argv, cfds)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  // echo has no copy of the read end, nor the write end
+  // beyond its 1, so read sees EOF once echo exits.
+  n = 0;
+  while(n < sizeof(buf) - 1 && read(fds[0], buf + n, 1) == 1)
+    n++;
+  buf[n] = 0;
+  close(fds[0]);
+  if(strcmp(buf, "spawned\n") != 0){
+    printf("%s: read \"%s\"\n", s, buf);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", argv, 0) >= 0){
+    printf("%s: spawned a missing program\n", s);
+    exit(1);
+  }
+  cfds[0] = 99;
+  if(spawn("echo", argv, cfds) >= 0){
+    printf("%s: spawned with a bad fd\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() sleeps at least as long as asked, but wakes
+// without waiting for the next clock tick.
+void
+nanosleeptest(char *s)
+{
+  uint64 t0, t1;
+  int i;
+
+  for(i = 0; i < 5; i++){
+    if(clock_gettime(&t0) < 0 || nanosleep(20*1000*1000) < 0 ||
+       clock_gettime(&t1) < 0){
+      printf("%s: nanosleep or clock_gettime failed\n", s);
+      exit(1);
+    }
+    if(t1 - t0 < 20*1000*1000){
+      printf("%s: slept %d ns, too short\n", s, (int)(t1 - t0));
+      exit(1);
+    }
+    if(t1 - t0 < 100*1000*1000)
+      return;
+  }
+  printf("%s: slept %d ns, too long\n", s, (int)(t1 - t0));
+  exit(1);
+}
+
+// mmap() a file MAP_PRIVATE and MAP_SHARED, and share
+// anonymous memory with a child.
+void
+mmaptest(char *s)
+{
+  int fd, i, n, pid, xstatus;
+  char *p;
+  int sz = PGSIZE*2 + PGSIZE/2;
+
+  for(i = 0; i < sz; i++)
+    buf[i] = 'A' + i % 23;
+  fd = open("mmap.tmp", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, sz) != sz){
+    printf("%s: create mmap.tmp failed\n", s);
+    exit(1);
+  }
+
+  // a private mapping reads the file, with zeros past
+  // the end, and its writes don't reach the file.
+  p = mmap(0, PGSIZE*3, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < PGSIZE*3; i++){
+    if(p[i] != (i < sz ? buf[i] : 0)){
+      printf("%s: mmap private wrong content at %d\n", s, i);
+      exit(1);
+    }
+  }
+  p[0] = 'x';
+  if(munmap(p, PGSIZE*3) != 0){
+    printf("%s: munmap private failed\n", s);
+    exit(1);
+  }
+
+  // a shared mapping's writes are seen by read() at once,
+  // and stay in the file after munmap().
+  p = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  p[1] = 'y';
+  p[PGSIZE*2 + 1] = 'z';
+  close(fd);
+  fd = open("mmap.tmp", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'A' || buf[1] != 'y'){
+    printf("%s: read doesn't see shared mapping\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) != 0 || munmap(p + PGSIZE, sz - PGSIZE) != 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("mmap.tmp", O_RDONLY);
+  n = read(fd, buf, BUFSZ);
+  close(fd);
+  unlink("mmap.tmp");
+  if(n != sz || buf[1] != 'y' || buf[PGSIZE*2 + 1] != 'z'){
+    printf("%s: shared mapping not written back\n", s);
+    exit(1);
+  }
+
+  // an unmapped page faults.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: unmapped page didn't fault\n", s);
+    exit(1);
+  }
+
+  // shared anonymous memory is shared with a child.
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap anonymous failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[10] = 42;
+    exit(0);
+  }
+  wait(0);
+  if(p[10] != 42){
+    printf("%s: anonymous mapping not shared with child\n", s);
+    exit(1);
+  }
+}
+
 //
 // use sbrk() to count how many free physical memory pages there are.
 // touches the pages to force allocation.
@@ -2690,29 +3491,45 @@ countfree()
   return n;
 }
 
-// run each test in its own process. run returns 1 if child's exit()
-// indicates success.
+//
+// exec() reads a program in a page at a time as it is first
+// touched, so usertests' own pages would look like lost free
+// pages if a test were the first to touch them. touch them
+// all before the first countfree().
+//
+void
+prefault()
+{
+  extern char end[];
+  volatile uint64 start = 0;
+  uint64 a;
+
+  for(a = start; a < (uint64)end; a += 4096)
+    (void) *(volatile char *)a;
+}
+
+char *progname = "usertests";
+
+// run each test in its own process, a fresh copy of usertests
+// started by spawn() as "usertests -x name". run returns 1 if
+// child's exit() indicates success.
 int
-run(void f(char *), char *s) {
+run(char *s) {
   int pid;
   int xstatus;
+  char *argv[] = { progname, "-x", s, 0 };
 
   printf("test %s: ", s);
-  if((pid = fork()) < 0) {
-    printf("runtest: fork error\n");
+  if((pid = spawn(progname, argv, 0)) < 0) {
+    printf("runtest: spawn error\n");
     exit(1);
   }
-  if(pid == 0) {
-    f(s);
-    exit(0);
-  } else {
-    wait(&xstatus);
-    if(xstatus != 0) 
-      printf("FAILED\n");
-    else
-      printf("OK\n");
-    return xstatus == 0;
-  }
+  wait(&xstatus);
+  if(xstatus != 0) 
+    printf("FAILED\n");
+  else
+    printf("OK\n");
+  return xstatus == 0;
 }
 
 int
@@ -2720,8 +3537,12 @@ main(int argc, char *argv[])
 {
   int continuous = 0;
   char *justone = 0;
+  char *child = 0;
 
-  if(argc == 2 && strcmp(argv[1], "-c") == 0){
+  progname = argv[0];
+  if(argc == 3 && strcmp(argv[1], "-x") == 0){
+    child = argv[2];
+  } else if(argc == 2 && strcmp(argv[1], "-c") == 0){
     continuous = 1;
   } else if(argc == 2 && strcmp(argv[1], "-C") == 0){
     continuous = 2;
@@ -2738,6 +3559,11 @@ main(int argc, char *argv[])
   } tests[] = {
     {manywrites, "manywrites"},
     {execout, "execout"},
+    {mmaptest, "mmaptest"},
+    {nanosleeptest, "nanosleeptest"},
+    {clonetest, "clonetest"},
+    {futextest, "futextest"},
+    {spawntest, "spawntest"},
     {copyin, "copyin"},
     {copyout, "copyout"},
     {copyinstr1, "copyinstr1"},
@@ -2786,6 +3612,15 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {pipebench, "pipebench"},
+    {splicetest, "splicetest"},
+    {iovtest, "iovtest"},
+    {ioringtest, "ioringtest"},
+    {polltest, "polltest"},
+    {fsynctest, "fsynctest"},
+    {vdsotest, "vdsotest"},
+    {sysstattest, "sysstattest"},
+    {proftest, "proftest"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
@@ -2798,13 +3633,27 @@ main(int argc, char *argv[])
     { 0, 0},
   };
 
+  // run() starts each test this way.
+  if(child){
+    for (struct test *t = tests; t->s != 0; t++) {
+      if(strcmp(t->s, child) == 0){
+        t->f(t->s);
+        exit(0);
+      }
+    }
+    printf("usertests: no test %s\n", child);
+    exit(1);
+  }
+
+  prefault();
+
   if(continuous){
     printf("continuous usertests starting\n");
     while(1){
       int fail = 0;
       int free0 = countfree();
       for (struct test *t = tests; t->s != 0; t++) {
-        if(!run(t->f, t->s)){
+        if(!run(t->s)){
           fail = 1;
           break;
         }
@@ -2829,7 +3678,7 @@ main(int argc, char *argv[])
   int fail = 0;
   for (struct test *t = tests; t->s != 0; t++) {
     if((justone == 0) || strcmp(t->s, justone) == 0) {
-      if(!run(t->f, t->s))
+      if(!run(t->s))
         fail = 1;
     }
   }
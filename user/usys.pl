@@ -37,4 +37,28 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 # lab9 q2
-entry("symlink");
\ No newline at end of file
+entry("symlink");
+entry("mmap");
+entry("munmap");
+entry("nice");
+entry("setpriority");
+entry("nanosleep");
+entry("clock_gettime");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("spawn");
+entry("splice");
+entry("tee");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("io_enter");
+entry("poll");
+entry("fsync");
+entry("fdatasync");
+entry("logmode");
+entry("sysstat");
+entry("profctl");